@@ -0,0 +1,716 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Ambient colour sensor input for the chameleon feature. Samples come
+ * from the sensor's IIO buffer through /dev/iio:deviceN, so the kernel
+ * wakes us when there is data instead of us polling sysfs. Every channel
+ * goes through a small moving average, and the HAL only hears about a
+ * reading once it moved far enough to be noticed. Readings are sent
+ * without waiting for the HAL, one at a time, and a newer reading
+ * replaces one that is still waiting to go out.
+ */
+
+#include "als.h"
+#include "pq-transport.h"
+#include <glib-unix.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define IIO_SYSFS_DIR "/sys/bus/iio/devices"
+/* Hands the sensor files to the session user, see 60-gsd-adapter-als.rules */
+#define ALS_UDEV_RULES "60-gsd-adapter-als.rules"
+
+/* Samples averaged per channel, a power of two keeps the mean cheap */
+#define ALS_WINDOW 8
+/* A channel has to move by this much before the HAL is told */
+#define ALS_THRESHOLD_PERCENT 10
+/* and by at least this many counts, so darkness noise is ignored */
+#define ALS_THRESHOLD_MIN 8
+/* Records read per wakeup */
+#define ALS_READ_RECORDS 16
+
+enum {
+    ALS_RED,
+    ALS_GREEN,
+    ALS_BLUE,
+    ALS_WHITE,
+    ALS_CHANNELS
+};
+
+/* Accepted scan element names per channel, in order of preference */
+static const char *const als_channel_names[ALS_CHANNELS][4] = {
+    [ALS_RED] = { "in_intensity_red", NULL },
+    [ALS_GREEN] = { "in_intensity_green", NULL },
+    [ALS_BLUE] = { "in_intensity_blue", NULL },
+    [ALS_WHITE] = { "in_intensity_clear", "in_intensity_both", "in_illuminance", NULL },
+};
+
+/* A setAmbientLightRGBW on its way to the HAL */
+typedef struct {
+    /* Cleared when the sensor is freed before the reply */
+    Als *als;
+    guint32 values[ALS_CHANNELS];
+} AlsCall;
+
+typedef struct {
+    gchar *name;
+    gboolean enabled;
+    guint index;
+    guint bits;
+    guint storage_bytes;
+    guint shift;
+    gboolean is_signed;
+    gboolean big_endian;
+    gsize offset;
+} AlsScanElement;
+
+struct _Als {
+    PQContext *ctx;
+    int device;
+    gchar *sysfs;
+
+    GArray *elements;
+    int channels[ALS_CHANNELS];
+    gsize record_size;
+
+    int fd;
+    guint watch_id;
+    guint8 *buffer;
+    gsize buffered;
+
+    guint32 window[ALS_CHANNELS][ALS_WINDOW];
+    guint64 sums[ALS_CHANNELS];
+    guint head;
+    guint filled;
+
+    guint32 sent[ALS_CHANNELS];
+    gboolean sent_valid;
+
+    AlsCall *call;
+    GCancellable *cancellable;
+    guint32 queued[ALS_CHANNELS];
+    gboolean queued_valid;
+};
+
+static gboolean
+write_sysfs(const gchar *path,
+            const gchar *value)
+{
+    GError *error = NULL;
+
+    if (!g_file_set_contents(path, value, -1, &error)) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gchar *
+read_sysfs(const gchar *dir,
+           const gchar *name)
+{
+    gchar *path = g_build_filename(dir, name, NULL);
+    gchar *contents = NULL;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL))
+        g_strstrip(contents);
+    g_free(path);
+    return contents;
+}
+
+/* e.g. "le:u16/16>>0", or "be:s12/16X2>>4" for repeated channels */
+static gboolean
+parse_scan_type(const gchar *type,
+                AlsScanElement *element)
+{
+    char endian[3] = { 0 };
+    char sign;
+    guint bits, storage, repeat = 1, shift = 0;
+
+    if (sscanf(type, "%2s:%c%u/%uX%u>>%u", endian, &sign, &bits, &storage, &repeat, &shift) != 6) {
+        repeat = 1;
+        if (sscanf(type, "%2s:%c%u/%u>>%u", endian, &sign, &bits, &storage, &shift) != 5)
+            return FALSE;
+    }
+
+    if (!bits || bits > 64 || storage % 8 || bits > storage || storage > 64 || !repeat)
+        return FALSE;
+
+    element->bits = bits;
+    element->storage_bytes = storage / 8 * repeat;
+    element->shift = shift;
+    element->is_signed = sign == 's';
+    element->big_endian = strcmp(endian, "be") == 0;
+    return TRUE;
+}
+
+static gint
+compare_elements(gconstpointer a,
+                 gconstpointer b)
+{
+    const AlsScanElement *x = a;
+    const AlsScanElement *y = b;
+
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static void
+clear_element(gpointer data)
+{
+    AlsScanElement *element = data;
+
+    g_free(element->name);
+}
+
+static GArray *
+read_scan_elements(const gchar *sysfs)
+{
+    gchar *dir = g_build_filename(sysfs, "scan_elements", NULL);
+    GArray *elements = g_array_new(FALSE, TRUE, sizeof(AlsScanElement));
+    GDir *scan = g_dir_open(dir, 0, NULL);
+    const gchar *file;
+
+    g_array_set_clear_func(elements, clear_element);
+    if (!scan)
+        goto out;
+
+    while ((file = g_dir_read_name(scan))) {
+        AlsScanElement element = { 0 };
+        gchar *name, *key, *value;
+
+        if (!g_str_has_suffix(file, "_en"))
+            continue;
+
+        name = g_strndup(file, strlen(file) - 3);
+
+        key = g_strconcat(name, "_type", NULL);
+        value = read_sysfs(dir, key);
+        g_free(key);
+        if (!value || !parse_scan_type(value, &element)) {
+            g_free(value);
+            g_free(name);
+            continue;
+        }
+        g_free(value);
+
+        key = g_strconcat(name, "_index", NULL);
+        value = read_sysfs(dir, key);
+        g_free(key);
+        if (!value) {
+            g_free(name);
+            continue;
+        }
+        element.index = atoi(value);
+        g_free(value);
+
+        value = read_sysfs(dir, file);
+        element.enabled = value && atoi(value) == 1;
+        g_free(value);
+
+        element.name = name;
+        g_array_append_val(elements, element);
+    }
+    g_dir_close(scan);
+
+    g_array_sort(elements, compare_elements);
+
+out:
+    g_free(dir);
+    return elements;
+}
+
+static gboolean
+als_pick_channels(Als *als)
+{
+    for (int c = 0; c < ALS_CHANNELS; c++) {
+        als->channels[c] = -1;
+
+        for (int n = 0; als_channel_names[c][n] && als->channels[c] < 0; n++) {
+            for (guint i = 0; i < als->elements->len; i++) {
+                AlsScanElement *element = &g_array_index(als->elements, AlsScanElement, i);
+
+                if (strcmp(element->name, als_channel_names[c][n]) == 0) {
+                    als->channels[c] = i;
+                    break;
+                }
+            }
+        }
+
+        if (als->channels[c] < 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Each enabled element sits at a multiple of its own size, in index
+ * order, and a record is padded to its largest element.
+ */
+static void
+als_compute_layout(Als *als)
+{
+    gsize offset = 0, largest = 1;
+
+    for (guint i = 0; i < als->elements->len; i++) {
+        AlsScanElement *element = &g_array_index(als->elements, AlsScanElement, i);
+        gsize size = element->storage_bytes;
+
+        if (!element->enabled)
+            continue;
+
+        offset = (offset + size - 1) / size * size;
+        element->offset = offset;
+        offset += size;
+        largest = MAX(largest, size);
+    }
+
+    als->record_size = (offset + largest - 1) / largest * largest;
+}
+
+static gboolean
+als_enable_elements(Als *als)
+{
+    gchar *dir = g_build_filename(als->sysfs, "scan_elements", NULL);
+    gboolean ret = TRUE;
+
+    for (int c = 0; c < ALS_CHANNELS; c++) {
+        AlsScanElement *element = &g_array_index(als->elements, AlsScanElement, als->channels[c]);
+        gchar *file, *path;
+
+        if (element->enabled)
+            continue;
+
+        file = g_strconcat(element->name, "_en", NULL);
+        path = g_build_filename(dir, file, NULL);
+        ret = write_sysfs(path, "1");
+        g_free(path);
+        g_free(file);
+        if (!ret)
+            break;
+
+        element->enabled = TRUE;
+    }
+
+    g_free(dir);
+    return ret;
+}
+
+/* Sensors without their own interrupt need the trigger the driver registered */
+static void
+als_setup_trigger(Als *als)
+{
+    gchar *current = read_sysfs(als->sysfs, "trigger/current_trigger");
+    gchar *name, *wanted, *path;
+
+    if (!current || current[0]) {
+        g_free(current);
+        return;
+    }
+    g_free(current);
+
+    name = read_sysfs(als->sysfs, "name");
+    if (!name)
+        return;
+
+    wanted = g_strdup_printf("%s-dev%d", name, als->device);
+    path = g_build_filename(als->sysfs, "trigger", "current_trigger", NULL);
+    write_sysfs(path, wanted);
+
+    g_free(path);
+    g_free(wanted);
+    g_free(name);
+}
+
+/*
+ * The buffer is set up through sysfs and read from the device node,
+ * which a session service can only do once the udev rule handed them
+ * over. A buffer someone else enabled, iio-sensor-proxy for one, is
+ * left alone.
+ */
+static gboolean
+als_check_access(Als *als)
+{
+    gchar *node = g_strdup_printf("/dev/iio:device%d", als->device);
+    gchar *enable = g_build_filename(als->sysfs, "buffer", "enable", NULL);
+    gchar *state = read_sysfs(als->sysfs, "buffer/enable");
+    gboolean ret = FALSE;
+
+    if (g_strcmp0(state, "1") == 0)
+        fprintf(stderr, "Skipping ambient light sensor iio:device%d, its buffer is in use by another reader\n",
+                als->device);
+    else if (access(enable, W_OK) < 0)
+        fprintf(stderr, "Skipping ambient light sensor iio:device%d, can't write %s: %s (see %s)\n",
+                als->device, enable, g_strerror(errno), ALS_UDEV_RULES);
+    else if (access(node, R_OK) < 0)
+        fprintf(stderr, "Skipping ambient light sensor iio:device%d, can't read %s: %s (see %s)\n",
+                als->device, node, g_strerror(errno), ALS_UDEV_RULES);
+    else
+        ret = TRUE;
+
+    g_free(state);
+    g_free(enable);
+    g_free(node);
+    return ret;
+}
+
+static gboolean
+als_set_buffer(Als *als,
+               gboolean enable)
+{
+    gchar *path = g_build_filename(als->sysfs, "buffer", "enable", NULL);
+    gboolean ret = write_sysfs(path, enable ? "1" : "0");
+
+    g_free(path);
+    return ret;
+}
+
+static guint32
+als_extract(const AlsScanElement *element,
+            const guint8 *record)
+{
+    const guint8 *data = record + element->offset;
+    guint bytes = MIN(element->storage_bytes, 8);
+    guint64 raw = 0;
+    gint64 value;
+
+    for (guint i = 0; i < bytes; i++) {
+        guint b = element->big_endian ? i : bytes - 1 - i;
+
+        raw = (raw << 8) | data[b];
+    }
+
+    raw >>= element->shift;
+    if (element->bits < 64)
+        raw &= (G_GUINT64_CONSTANT(1) << element->bits) - 1;
+
+    if (element->is_signed && element->bits < 64 && (raw >> (element->bits - 1)) & 1)
+        value = (gint64)(raw | ~((G_GUINT64_CONSTANT(1) << element->bits) - 1));
+    else
+        value = (gint64)raw;
+
+    return (guint32)CLAMP(value, 0, G_MAXINT32);
+}
+
+static gboolean
+als_perceptible(Als *als,
+                const guint32 *mean)
+{
+    if (!als->sent_valid)
+        return TRUE;
+
+    for (int c = 0; c < ALS_CHANNELS; c++) {
+        guint32 delta = mean[c] > als->sent[c] ? mean[c] - als->sent[c] : als->sent[c] - mean[c];
+
+        if (delta >= ALS_THRESHOLD_MIN &&
+            (guint64)delta * 100 >= (guint64)als->sent[c] * ALS_THRESHOLD_PERCENT)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void als_send_queued(Als *als);
+
+/* Runs once the call is answered, dropped or cancelled */
+static void
+on_als_sent(GObject *source,
+            GAsyncResult *result,
+            gpointer user_data)
+{
+    AlsCall *call = user_data;
+    Als *als = call->als;
+    GError *error = NULL;
+    int ret = pq_call_finish(result, NULL, &error);
+
+    if (!als) {
+        g_clear_error(&error);
+        g_free(call);
+        return;
+    }
+
+    if (error) {
+        g_debug("Failed to send ambient light: %s", error->message);
+        g_error_free(error);
+    } else if (ret == 0) {
+        memcpy(als->sent, call->values, sizeof(als->sent));
+        als->sent_valid = TRUE;
+    }
+
+    g_free(call);
+    als->call = NULL;
+    g_clear_object(&als->cancellable);
+    /* Queued against the previous reading, it may be close to this one */
+    if (als->queued_valid && !als_perceptible(als, als->queued))
+        als->queued_valid = FALSE;
+    als_send_queued(als);
+}
+
+static void
+als_send_queued(Als *als)
+{
+    PQContext *ctx = als->ctx;
+    PQArg args[PQ_MAX_ARGS] = { 0 };
+
+    /* The reply of the call in flight sends what is queued by then */
+    if (als->call || !als->queued_valid || als->fd < 0)
+        return;
+
+    /* Not connected, a stale reading would wait in the queue, the next sample tries again */
+    if (!ctx->connected)
+        return;
+
+    als->call = g_new0(AlsCall, 1);
+    als->call->als = als;
+    als->cancellable = g_cancellable_new();
+    memcpy(als->call->values, als->queued, sizeof(als->call->values));
+    for (int c = 0; c < ALS_CHANNELS; c++)
+        args[c].i = (gint32)MIN(als->queued[c], (guint32)G_MAXINT32);
+    als->queued_valid = FALSE;
+
+    /* Ordered with the context's other calls, enableChameleon in particular */
+    pq_call_async(ctx, SET_AMBIENT_LIGHT_RGBW, args, als->cancellable, on_als_sent, als->call);
+}
+
+static void
+als_push_sample(Als *als,
+                const guint32 *sample)
+{
+    guint32 mean[ALS_CHANNELS];
+
+    for (int c = 0; c < ALS_CHANNELS; c++) {
+        als->sums[c] -= als->window[c][als->head];
+        als->window[c][als->head] = sample[c];
+        als->sums[c] += sample[c];
+    }
+    als->head = (als->head + 1) % ALS_WINDOW;
+    if (als->filled < ALS_WINDOW) {
+        als->filled++;
+        /* Don't act on a half empty window */
+        if (als->filled < ALS_WINDOW)
+            return;
+    }
+
+    for (int c = 0; c < ALS_CHANNELS; c++)
+        mean[c] = als->sums[c] / ALS_WINDOW;
+
+    if (!als_perceptible(als, mean))
+        return;
+
+    memcpy(als->queued, mean, sizeof(als->queued));
+    als->queued_valid = TRUE;
+    als_send_queued(als);
+}
+
+static void als_stop(Als *als);
+
+static gboolean
+on_als_readable(gint fd,
+                GIOCondition condition,
+                gpointer user_data)
+{
+    Als *als = user_data;
+    gsize size = als->record_size * ALS_READ_RECORDS;
+    gsize consumed = 0;
+    ssize_t len;
+
+    if (condition & (G_IO_ERR | G_IO_HUP)) {
+        fprintf(stderr, "Ambient light sensor went away\n");
+        als->watch_id = 0;
+        als_stop(als);
+        return G_SOURCE_REMOVE;
+    }
+
+    len = read(fd, als->buffer + als->buffered, size - als->buffered);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return G_SOURCE_CONTINUE;
+        fprintf(stderr, "Failed to read ambient light sensor: %s\n", g_strerror(errno));
+        als->watch_id = 0;
+        als_stop(als);
+        return G_SOURCE_REMOVE;
+    }
+    als->buffered += len;
+
+    while (als->buffered - consumed >= als->record_size) {
+        const guint8 *record = als->buffer + consumed;
+        guint32 sample[ALS_CHANNELS];
+
+        for (int c = 0; c < ALS_CHANNELS; c++)
+            sample[c] = als_extract(&g_array_index(als->elements, AlsScanElement, als->channels[c]), record);
+
+        als_push_sample(als, sample);
+        consumed += als->record_size;
+    }
+
+    /* Keep a partial record for the next wakeup */
+    memmove(als->buffer, als->buffer + consumed, als->buffered - consumed);
+    als->buffered -= consumed;
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+als_reset_filter(Als *als)
+{
+    memset(als->window, 0, sizeof(als->window));
+    memset(als->sums, 0, sizeof(als->sums));
+    als->head = 0;
+    als->filled = 0;
+    als->buffered = 0;
+}
+
+static void
+als_start(Als *als)
+{
+    gchar *node = g_strdup_printf("/dev/iio:device%d", als->device);
+
+    als->fd = open(node, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (als->fd < 0) {
+        fprintf(stderr, "Failed to open %s: %s\n", node, g_strerror(errno));
+        g_free(node);
+        return;
+    }
+    g_free(node);
+
+    if (!als_set_buffer(als, TRUE)) {
+        close(als->fd);
+        als->fd = -1;
+        return;
+    }
+
+    als_reset_filter(als);
+    /* The light may be different by the time we wake up again */
+    als->sent_valid = FALSE;
+    als->watch_id = g_unix_fd_add(als->fd, G_IO_IN | G_IO_ERR | G_IO_HUP, on_als_readable, als);
+}
+
+static void
+als_stop(Als *als)
+{
+    if (als->watch_id) {
+        g_source_remove(als->watch_id);
+        als->watch_id = 0;
+    }
+
+    if (als->fd >= 0) {
+        als_set_buffer(als, FALSE);
+        close(als->fd);
+        als->fd = -1;
+    }
+
+    /* A call in flight still lands, there is nothing newer to follow it */
+    als->queued_valid = FALSE;
+}
+
+static Als *
+als_open_device(PQContext *ctx,
+                const gchar *dir_name)
+{
+    Als *als;
+    int device;
+
+    if (sscanf(dir_name, "iio:device%d", &device) != 1)
+        return NULL;
+
+    als = g_new0(Als, 1);
+    als->ctx = ctx;
+    als->device = device;
+    als->fd = -1;
+    als->sysfs = g_build_filename(IIO_SYSFS_DIR, dir_name, NULL);
+    als->elements = read_scan_elements(als->sysfs);
+
+    if (!als_pick_channels(als) || !als_check_access(als)) {
+        als_free(als);
+        return NULL;
+    }
+
+    return als;
+}
+
+Als *
+als_new(PQContext *ctx)
+{
+    GDir *dir = g_dir_open(IIO_SYSFS_DIR, 0, NULL);
+    const gchar *name;
+    Als *als = NULL;
+
+    if (!dir) {
+        g_print("No ambient light sensor, %s is missing\n", IIO_SYSFS_DIR);
+        return NULL;
+    }
+
+    while (!als && (name = g_dir_read_name(dir)))
+        als = als_open_device(ctx, name);
+    g_dir_close(dir);
+
+    if (!als) {
+        g_print("No usable ambient colour sensor found\n");
+        return NULL;
+    }
+
+    if (!als_enable_elements(als)) {
+        fprintf(stderr, "Skipping ambient light sensor iio:device%d, its channels can't be enabled\n",
+                als->device);
+        als_free(als);
+        return NULL;
+    }
+
+    als_setup_trigger(als);
+    als_compute_layout(als);
+    als->buffer = g_malloc(als->record_size * ALS_READ_RECORDS);
+
+    g_print("Ambient light sensor: iio:device%d, %" G_GSIZE_FORMAT " byte records\n",
+            als->device, als->record_size);
+    return als;
+}
+
+void
+als_free(Als *als)
+{
+    if (!als)
+        return;
+
+    als_stop(als);
+    if (als->call) {
+        als->call->als = NULL;
+        /* Dropped from the queue if not sent yet, the reply is ignored otherwise */
+        g_cancellable_cancel(als->cancellable);
+        g_object_unref(als->cancellable);
+    }
+    if (als->elements)
+        g_array_free(als->elements, TRUE);
+    g_free(als->buffer);
+    g_free(als->sysfs);
+    g_free(als);
+}
+
+void
+als_set_active(Als *als,
+               gboolean active)
+{
+    if (!als || active == (als->fd >= 0))
+        return;
+
+    if (active)
+        als_start(als);
+    else
+        als_stop(als);
+}
+
+void
+als_invalidate(Als *als)
+{
+    if (als)
+        als->sent_valid = FALSE;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef ALS_H
+#define ALS_H
+
+#include "pq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _Als Als;
+
+/**
+ * Find an IIO colour sensor with red, green, blue and clear (or
+ * illuminance) channels and prepare its buffer. Nothing is read until
+ * the sensor is activated. A sensor whose buffer another reader already
+ * enabled, or that the session has no access to, is skipped and the
+ * reason logged.
+ *
+ * @param ctx PQ context the readings are sent to with setAmbientLightRGBW.
+ * @return A new sensor, or NULL if there is no usable colour sensor.
+ */
+Als *als_new(PQContext *ctx);
+
+/**
+ * Free a sensor, stopping its buffer first.
+ *
+ * @param als The sensor, may be NULL.
+ */
+void als_free(Als *als);
+
+/**
+ * Start or stop reading the sensor. An inactive sensor has its buffer
+ * disabled and no source on the main loop.
+ *
+ * @param als The sensor.
+ * @param active TRUE to read samples, FALSE to sleep.
+ */
+void als_set_active(Als *als, gboolean active);
+
+/**
+ * Forget the last reading sent to the HAL, so the next filtered sample
+ * is sent even if it hasn't changed, e.g. after the HAL restarted.
+ *
+ * @param als The sensor.
+ */
+void als_invalidate(Als *als);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ALS_H
@@ -5,19 +5,136 @@
  */
 
 #include "alsa.h"
+#include <glib.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
 
-int set_capture_state(const char *card, const char *selem_name, int capture) {
-    snd_mixer_t *handle;
-    snd_mixer_selem_id_t *sid;
+/* Elements kept per mixer, gsd-adapter only ever touches a couple */
+#define ALSA_MIXER_MAX_ELEMS 8
+/* Reload delays for a watched mixer whose card went away */
+#define ALSA_MIXER_RETRY_MIN_MS 250
+#define ALSA_MIXER_RETRY_MAX_MS 30000
+
+typedef struct {
+    char *name;
     snd_mixer_elem_t *elem;
-    int ret = 0;
+} AlsaMixerElem;
+
+typedef struct {
+    GSource source;
+    struct _AlsaMixer *mixer;
+    GPollFD *fds;
+    int n_fds;
+} AlsaMixerSource;
+
+struct _AlsaMixer {
+    char *card;
+    snd_mixer_t *handle;
+    AlsaMixerElem elems[ALSA_MIXER_MAX_ELEMS];
+    int n_elems;
+
+    /* Set by alsa_mixer_watch() */
+    AlsaMixerSource *source;
+    char *watch_name;
+    AlsaMixerChangedFunc watch_func;
+    void *watch_data;
+    gboolean changed;
+    guint retry_id;
+    guint retry_ms;
+};
+
+static snd_mixer_elem_t *alsa_mixer_find(AlsaMixer *mixer, const char *selem_name);
+
+static void alsa_mixer_forget(AlsaMixer *mixer, snd_mixer_elem_t *elem) {
+    for (int i = 0; i < mixer->n_elems; i++) {
+        if (mixer->elems[i].elem != elem)
+            continue;
+
+        free(mixer->elems[i].name);
+        mixer->elems[i] = mixer->elems[--mixer->n_elems];
+        return;
+    }
+}
+
+/* The element is freed by ALSA once it's removed, drop our pointer first */
+static int on_elem_event(snd_mixer_elem_t *elem, unsigned int mask) {
+    AlsaMixer *mixer = snd_mixer_elem_get_callback_private(elem);
+
+    if (mask == SND_CTL_EVENT_MASK_REMOVE) {
+        alsa_mixer_forget(mixer, elem);
+        return 0;
+    }
+
+    /* Reported once ALSA is done dispatching, see alsa_mixer_source_dispatch() */
+    if ((mask & SND_CTL_EVENT_MASK_VALUE) && mixer->watch_name &&
+        alsa_mixer_find(mixer, mixer->watch_name) == elem)
+        mixer->changed = TRUE;
+
+    return 0;
+}
+
+/* The source polls exactly the descriptors of the current handle, none without one */
+static void alsa_mixer_update_fds(AlsaMixer *mixer) {
+    AlsaMixerSource *source = mixer->source;
+    struct pollfd *pfds;
+    int count;
+
+    if (!source)
+        return;
+
+    for (int i = 0; i < source->n_fds; i++)
+        g_source_remove_poll(&source->source, &source->fds[i]);
+    g_free(source->fds);
+    source->fds = NULL;
+    source->n_fds = 0;
+
+    if (!mixer->handle)
+        return;
+
+    count = snd_mixer_poll_descriptors_count(mixer->handle);
+    if (count <= 0)
+        return;
+
+    pfds = g_new0(struct pollfd, count);
+    count = snd_mixer_poll_descriptors(mixer->handle, pfds, count);
+    if (count > 0) {
+        source->fds = g_new0(GPollFD, count);
+        source->n_fds = count;
+        for (int i = 0; i < count; i++) {
+            source->fds[i].fd = pfds[i].fd;
+            source->fds[i].events = pfds[i].events;
+            g_source_add_poll(&source->source, &source->fds[i]);
+        }
+    }
+    g_free(pfds);
+}
+
+static void alsa_mixer_unload(AlsaMixer *mixer) {
+    for (int i = 0; i < mixer->n_elems; i++)
+        free(mixer->elems[i].name);
+    mixer->n_elems = 0;
+
+    if (mixer->handle) {
+        snd_mixer_close(mixer->handle);
+        mixer->handle = NULL;
+    }
+
+    alsa_mixer_update_fds(mixer);
+}
+
+static int alsa_mixer_load(AlsaMixer *mixer) {
+    snd_mixer_t *handle;
+    int ret;
+
+    alsa_mixer_unload(mixer);
 
     if ((ret = snd_mixer_open(&handle, 0)) < 0) {
         fprintf(stderr, "Failed to open mixer: %s\n", snd_strerror(ret));
         return ret;
     }
 
-    if ((ret = snd_mixer_attach(handle, card)) < 0) {
+    if ((ret = snd_mixer_attach(handle, mixer->card)) < 0) {
         fprintf(stderr, "Failed to attach mixer: %s\n", snd_strerror(ret));
         snd_mixer_close(handle);
         return ret;
@@ -35,21 +152,270 @@ int set_capture_state(const char *card, const char *selem_name, int capture) {
         return ret;
     }
 
+    mixer->handle = handle;
+    if (mixer->retry_id) {
+        g_source_remove(mixer->retry_id);
+        mixer->retry_id = 0;
+    }
+    mixer->retry_ms = 0;
+    alsa_mixer_update_fds(mixer);
+    /* Install the element callback again on the new handle */
+    if (mixer->watch_name)
+        alsa_mixer_find(mixer, mixer->watch_name);
+    return 0;
+}
+
+static snd_mixer_elem_t *alsa_mixer_find(AlsaMixer *mixer, const char *selem_name) {
+    snd_mixer_selem_id_t *sid;
+    snd_mixer_elem_t *elem;
+
+    for (int i = 0; i < mixer->n_elems; i++) {
+        if (strcmp(mixer->elems[i].name, selem_name) == 0)
+            return mixer->elems[i].elem;
+    }
+
     snd_mixer_selem_id_alloca(&sid);
     snd_mixer_selem_id_set_index(sid, 0);
     snd_mixer_selem_id_set_name(sid, selem_name);
 
-    elem = snd_mixer_find_selem(handle, sid);
+    elem = snd_mixer_find_selem(mixer->handle, sid);
+    if (!elem || mixer->n_elems == ALSA_MIXER_MAX_ELEMS)
+        return elem;
+
+    mixer->elems[mixer->n_elems].name = strdup(selem_name);
+    mixer->elems[mixer->n_elems].elem = elem;
+    mixer->n_elems++;
+    snd_mixer_elem_set_callback(elem, on_elem_event);
+    snd_mixer_elem_set_callback_private(elem, mixer);
+
+    return elem;
+}
+
+static gboolean alsa_mixer_retry(gpointer data);
+
+/* Nothing reports the card coming back, so a watched mixer keeps trying */
+static void alsa_mixer_schedule_retry(AlsaMixer *mixer) {
+    if (!mixer->source || mixer->retry_id)
+        return;
+
+    mixer->retry_ms = mixer->retry_ms ? MIN(mixer->retry_ms * 2, ALSA_MIXER_RETRY_MAX_MS) : ALSA_MIXER_RETRY_MIN_MS;
+    mixer->retry_id = g_timeout_add(mixer->retry_ms, alsa_mixer_retry, mixer);
+}
+
+/* The element may have been switched while the card was away, let the watcher check it */
+static gboolean alsa_mixer_retry(gpointer data) {
+    AlsaMixer *mixer = data;
+
+    mixer->retry_id = 0;
+    if (alsa_mixer_load(mixer) < 0) {
+        alsa_mixer_schedule_retry(mixer);
+        return G_SOURCE_REMOVE;
+    }
+
+    mixer->watch_func(mixer, mixer->watch_name, mixer->watch_data);
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Pick up whatever changed since the last call. A card that went away
+ * fails here, so it is enumerated again, which also finds it once it's
+ * back. A watched mixer gets its events from the main loop instead, and
+ * is loaded again by a retry timer once its card went away.
+ */
+static int alsa_mixer_refresh(AlsaMixer *mixer) {
+    if (mixer->handle && mixer->source)
+        return 0;
+    if (mixer->handle && snd_mixer_handle_events(mixer->handle) >= 0)
+        return 0;
+
+    return alsa_mixer_load(mixer);
+}
+
+static gboolean alsa_mixer_source_prepare(GSource *source, gint *timeout) {
+    *timeout = -1;
+    return FALSE;
+}
+
+static gboolean alsa_mixer_source_check(GSource *source) {
+    AlsaMixerSource *mixer_source = (AlsaMixerSource *)source;
+
+    for (int i = 0; i < mixer_source->n_fds; i++) {
+        if (mixer_source->fds[i].revents)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static gboolean alsa_mixer_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+    AlsaMixerSource *mixer_source = (AlsaMixerSource *)source;
+    AlsaMixer *mixer = mixer_source->mixer;
+    struct pollfd *pfds = g_new0(struct pollfd, mixer_source->n_fds);
+    unsigned short revents = 0;
+    int n_fds = mixer_source->n_fds;
+
+    for (int i = 0; i < n_fds; i++) {
+        pfds[i].fd = mixer_source->fds[i].fd;
+        pfds[i].events = mixer_source->fds[i].events;
+        pfds[i].revents = mixer_source->fds[i].revents;
+        mixer_source->fds[i].revents = 0;
+    }
+
+    if (mixer->handle)
+        snd_mixer_poll_descriptors_revents(mixer->handle, pfds, n_fds, &revents);
+    g_free(pfds);
+
+    if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        /* The card is gone, retry until it's back */
+        alsa_mixer_unload(mixer);
+        alsa_mixer_schedule_retry(mixer);
+    } else if (revents & POLLIN) {
+        if (snd_mixer_handle_events(mixer->handle) < 0) {
+            alsa_mixer_unload(mixer);
+            alsa_mixer_schedule_retry(mixer);
+        }
+    }
+
+    if (mixer->changed) {
+        mixer->changed = FALSE;
+        mixer->watch_func(mixer, mixer->watch_name, mixer->watch_data);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs alsa_mixer_source_funcs = {
+    .prepare = alsa_mixer_source_prepare,
+    .check = alsa_mixer_source_check,
+    .dispatch = alsa_mixer_source_dispatch,
+};
+
+AlsaMixer *alsa_mixer_open(const char *card) {
+    AlsaMixer *mixer = calloc(1, sizeof(AlsaMixer));
+
+    if (!mixer)
+        return NULL;
+
+    mixer->card = strdup(card);
+    if (!mixer->card) {
+        free(mixer);
+        return NULL;
+    }
+
+    /* Not fatal, the card may show up later */
+    alsa_mixer_load(mixer);
+    return mixer;
+}
+
+void alsa_mixer_close(AlsaMixer *mixer) {
+    if (!mixer)
+        return;
+
+    if (mixer->retry_id)
+        g_source_remove(mixer->retry_id);
+
+    if (mixer->source) {
+        g_source_destroy(&mixer->source->source);
+        g_free(mixer->source->fds);
+        g_source_unref(&mixer->source->source);
+        mixer->source = NULL;
+    }
+
+    alsa_mixer_unload(mixer);
+    free(mixer->watch_name);
+    free(mixer->card);
+    free(mixer);
+}
+
+int alsa_mixer_set_capture_state(AlsaMixer *mixer, const char *selem_name, int capture) {
+    snd_mixer_elem_t *elem;
+    int ret;
+
+    if ((ret = alsa_mixer_refresh(mixer)) < 0)
+        return ret;
+
+    elem = alsa_mixer_find(mixer, selem_name);
     if (!elem) {
         fprintf(stderr, "Failed to find mixer element\n");
-        snd_mixer_close(handle);
         return -1;
     }
 
-    if ((ret = snd_mixer_selem_set_capture_switch_all(elem, capture)) < 0) {
+    ret = snd_mixer_selem_set_capture_switch_all(elem, capture);
+    if (ret == -ENODEV) {
+        /* Unplugged since the last event was read, try the new card once */
+        if ((ret = alsa_mixer_load(mixer)) < 0)
+            return ret;
+
+        elem = alsa_mixer_find(mixer, selem_name);
+        if (!elem) {
+            fprintf(stderr, "Failed to find mixer element\n");
+            return -1;
+        }
+
+        ret = snd_mixer_selem_set_capture_switch_all(elem, capture);
+    }
+
+    if (ret < 0)
         fprintf(stderr, "Failed to set capture: %s\n", snd_strerror(ret));
+
+    return ret;
+}
+
+int alsa_mixer_watch(AlsaMixer *mixer, const char *selem_name, AlsaMixerChangedFunc func, void *user_data) {
+    if (mixer->source)
+        return -EBUSY;
+
+    mixer->watch_name = strdup(selem_name);
+    if (!mixer->watch_name)
+        return -ENOMEM;
+    mixer->watch_func = func;
+    mixer->watch_data = user_data;
+
+    mixer->source = (AlsaMixerSource *)g_source_new(&alsa_mixer_source_funcs, sizeof(AlsaMixerSource));
+    mixer->source->mixer = mixer;
+    g_source_attach(&mixer->source->source, NULL);
+
+    alsa_mixer_update_fds(mixer);
+    if (mixer->handle)
+        alsa_mixer_find(mixer, selem_name);
+    else
+        alsa_mixer_schedule_retry(mixer);
+
+    return 0;
+}
+
+int alsa_mixer_get_capture_state(AlsaMixer *mixer, const char *selem_name) {
+    snd_mixer_elem_t *elem;
+    int ret;
+
+    if ((ret = alsa_mixer_refresh(mixer)) < 0)
+        return ret;
+
+    elem = alsa_mixer_find(mixer, selem_name);
+    if (!elem || !snd_mixer_selem_has_capture_switch(elem))
+        return -ENOENT;
+
+    /* Any channel capturing counts as capturing */
+    for (int channel = 0; channel <= SND_MIXER_SCHN_LAST; channel++) {
+        int value = 0;
+
+        if (!snd_mixer_selem_has_capture_channel(elem, channel))
+            continue;
+        if (snd_mixer_selem_get_capture_switch(elem, channel, &value) >= 0 && value)
+            return 1;
     }
 
-    snd_mixer_close(handle);
+    return 0;
+}
+
+int set_capture_state(const char *card, const char *selem_name, int capture) {
+    AlsaMixer *mixer = alsa_mixer_open(card);
+    int ret;
+
+    if (!mixer)
+        return -ENOMEM;
+
+    ret = alsa_mixer_set_capture_state(mixer, selem_name, capture);
+    alsa_mixer_close(mixer);
     return ret;
 }
@@ -14,8 +14,71 @@
 extern "C" {
 #endif
 
+typedef struct _AlsaMixer AlsaMixer;
+
+/**
+ * Called when the value of a watched mixer element changed.
+ *
+ * @param mixer The mixer.
+ * @param selem_name The name of the mixer simple element.
+ * @param user_data The data given to alsa_mixer_watch().
+ */
+typedef void (*AlsaMixerChangedFunc)(AlsaMixer *mixer, const char *selem_name, void *user_data);
+
+/**
+ * Open a long-lived mixer for a sound card. Elements are looked up once
+ * and kept, the card is only enumerated again after it was unplugged.
+ *
+ * @param card The identifier for the sound card (e.g., "hw:0").
+ * @return A new mixer, or NULL if out of memory. The card doesn't have to be present yet.
+ */
+AlsaMixer *alsa_mixer_open(const char *card);
+
+/**
+ * Close a mixer opened with alsa_mixer_open().
+ *
+ * @param mixer The mixer to close, may be NULL.
+ */
+void alsa_mixer_close(AlsaMixer *mixer);
+
+/**
+ * Set the capture state of a mixer element.
+ *
+ * @param mixer The mixer.
+ * @param selem_name The name of the mixer simple element.
+ * @param capture The capture state to set (0 for mute, 1 for unmute).
+ * @return 0 on success, negative error code on failure.
+ */
+int alsa_mixer_set_capture_state(AlsaMixer *mixer, const char *selem_name, int capture);
+
+/**
+ * Get the capture state of a mixer element.
+ *
+ * @param mixer The mixer.
+ * @param selem_name The name of the mixer simple element.
+ * @return 1 if any channel captures, 0 if none does, negative error code on failure.
+ */
+int alsa_mixer_get_capture_state(AlsaMixer *mixer, const char *selem_name);
+
+/**
+ * Watch a mixer element from the default GLib main context. The mixer's
+ * poll descriptors are added to the loop, so nothing wakes up until the
+ * card reports a change. Only one element can be watched per mixer.
+ * While the card is away it is looked for again with a growing delay,
+ * and func runs once it's back.
+ *
+ * @param mixer The mixer.
+ * @param selem_name The name of the mixer simple element to watch.
+ * @param func Called whenever the element's value changed, including by us.
+ * @param user_data Passed to func.
+ * @return 0 on success, negative error code on failure.
+ */
+int alsa_mixer_watch(AlsaMixer *mixer, const char *selem_name, AlsaMixerChangedFunc func, void *user_data);
+
 /**
- * Set the capture state of an ALSA mixer element.
+ * Set the capture state of an ALSA mixer element, opening and closing
+ * the mixer around it. Prefer alsa_mixer_set_capture_state() for
+ * repeated changes.
  *
  * @param card The identifier for the sound card (e.g., "hw:0").
  * @param selem_name The name of the mixer simple element.
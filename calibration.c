@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Night light calibration. The measured points are expanded once into a
+ * table with an entry per Kelvin, so mapping a temperature change is a
+ * single lookup.
+ */
+
+#include "calibration.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CALIBRATION_GROUP "NightLight"
+#define CALIBRATION_KEY "Points"
+#define CALIBRATION_TABLE_SIZE (CALIBRATION_MAX_KELVIN - CALIBRATION_MIN_KELVIN + 1)
+
+typedef struct {
+    guint32 kelvin;
+    int strength;
+} CalibrationPoint;
+
+struct _Calibration {
+    gchar *source;
+    gint16 table[CALIBRATION_TABLE_SIZE];
+};
+
+/*
+ * The curve gsd-adapter always used: 1700K to 4700K reversed onto 0 to
+ * 1000, scaled by 0.3, which is 0.1 strength per Kelvin below 4700K.
+ */
+static const CalibrationPoint default_points[] = {
+    { 1000, 370 },
+    { 4700, 0 },
+};
+
+static int
+compare_points(const void *a,
+               const void *b)
+{
+    const CalibrationPoint *x = a;
+    const CalibrationPoint *y = b;
+
+    return x->kelvin < y->kelvin ? -1 : x->kelvin > y->kelvin;
+}
+
+static void
+calibration_fill(Calibration *calibration,
+                 const CalibrationPoint *points,
+                 gsize n_points)
+{
+    gsize next = 0;
+
+    for (guint32 i = 0; i < CALIBRATION_TABLE_SIZE; i++) {
+        guint32 kelvin = CALIBRATION_MIN_KELVIN + i;
+        const CalibrationPoint *lo, *hi;
+        int strength;
+
+        while (next < n_points && points[next].kelvin <= kelvin)
+            next++;
+
+        if (next == 0) {
+            strength = points[0].strength;
+        } else if (next == n_points) {
+            strength = points[n_points - 1].strength;
+        } else {
+            lo = &points[next - 1];
+            hi = &points[next];
+            /* Anchored on the upper point so the built-in curve truncates like the old formula */
+            strength = hi->strength + (int)(((gint64)(lo->strength - hi->strength) *
+                                             (hi->kelvin - kelvin)) / (hi->kelvin - lo->kelvin));
+        }
+
+        calibration->table[i] = CLAMP(strength, G_MININT16, G_MAXINT16);
+    }
+}
+
+static gboolean
+parse_point(const gchar *entry,
+            CalibrationPoint *point)
+{
+    gchar *end;
+    guint64 kelvin;
+    gint64 strength;
+
+    kelvin = g_ascii_strtoull(entry, &end, 10);
+    if (end == entry || *end != ':')
+        return FALSE;
+
+    entry = end + 1;
+    strength = g_ascii_strtoll(entry, &end, 10);
+    if (end == entry || *end != '\0')
+        return FALSE;
+
+    if (kelvin == 0 || kelvin > G_MAXUINT32 || strength < G_MININT16 || strength > G_MAXINT16)
+        return FALSE;
+
+    point->kelvin = (guint32)kelvin;
+    point->strength = (int)strength;
+    return TRUE;
+}
+
+static gboolean
+calibration_load_file(Calibration *calibration,
+                      const gchar *path)
+{
+    GKeyFile *keyfile = g_key_file_new();
+    GError *error = NULL;
+    CalibrationPoint *points = NULL;
+    gchar **entries = NULL;
+    gsize n_entries = 0;
+    gboolean ret = FALSE;
+
+    if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, &error)) {
+        /* Not having a file at one of the locations is the normal case */
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            fprintf(stderr, "Failed to load calibration %s: %s\n", path, error->message);
+        goto out;
+    }
+
+    entries = g_key_file_get_string_list(keyfile, CALIBRATION_GROUP, CALIBRATION_KEY,
+                                         &n_entries, &error);
+    if (!entries) {
+        fprintf(stderr, "Invalid calibration %s: %s\n", path, error->message);
+        goto out;
+    }
+
+    points = g_new0(CalibrationPoint, MAX(n_entries, 1));
+    for (gsize i = 0; i < n_entries; i++) {
+        if (!parse_point(g_strstrip(entries[i]), &points[i])) {
+            fprintf(stderr, "Invalid calibration %s: bad point \"%s\"\n", path, entries[i]);
+            goto out;
+        }
+    }
+
+    if (n_entries < 2) {
+        fprintf(stderr, "Invalid calibration %s: at least two points are needed\n", path);
+        goto out;
+    }
+
+    qsort(points, n_entries, sizeof(CalibrationPoint), compare_points);
+    for (gsize i = 1; i < n_entries; i++) {
+        if (points[i].kelvin == points[i - 1].kelvin) {
+            fprintf(stderr, "Invalid calibration %s: %uK is listed twice\n", path, points[i].kelvin);
+            goto out;
+        }
+    }
+
+    calibration_fill(calibration, points, n_entries);
+    calibration->source = g_strdup(path);
+    ret = TRUE;
+
+out:
+    g_clear_error(&error);
+    g_strfreev(entries);
+    g_free(points);
+    g_key_file_free(keyfile);
+    return ret;
+}
+
+Calibration *
+calibration_load(const char *device)
+{
+    Calibration *calibration = g_new0(Calibration, 1);
+    gchar *paths[4] = { NULL };
+    int n_paths = 0;
+
+    /* Most specific first: the user's tuning, the image's, the device's */
+    paths[n_paths++] = g_build_filename(g_get_user_config_dir(), "pqadapter", "night-light.conf", NULL);
+    paths[n_paths++] = g_strdup("/etc/pqadapter/night-light.conf");
+    if (device && device[0] && !strchr(device, '/')) {
+        gchar *name = g_strconcat(device, ".conf", NULL);
+
+        paths[n_paths++] = g_build_filename("/usr/share/pqadapter/night-light", name, NULL);
+        g_free(name);
+    }
+
+    for (int i = 0; i < n_paths; i++) {
+        if (calibration_load_file(calibration, paths[i]))
+            break;
+    }
+
+    if (!calibration->source)
+        calibration_fill(calibration, default_points, G_N_ELEMENTS(default_points));
+
+    for (int i = 0; i < n_paths; i++)
+        g_free(paths[i]);
+
+    return calibration;
+}
+
+void
+calibration_free(Calibration *calibration)
+{
+    if (!calibration)
+        return;
+
+    g_free(calibration->source);
+    g_free(calibration);
+}
+
+const char *
+calibration_source(const Calibration *calibration)
+{
+    return calibration->source;
+}
+
+int
+calibration_strength(const Calibration *calibration,
+                     guint32 kelvin)
+{
+    kelvin = CLAMP(kelvin, CALIBRATION_MIN_KELVIN, CALIBRATION_MAX_KELVIN);
+    return calibration->table[kelvin - CALIBRATION_MIN_KELVIN];
+}
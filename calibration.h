@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Night light temperatures covered by the lookup table, as in gsd-color */
+#define CALIBRATION_MIN_KELVIN 1000
+#define CALIBRATION_MAX_KELVIN 10000
+
+typedef struct _Calibration Calibration;
+
+/**
+ * Load the night light calibration for a panel.
+ *
+ * The first file found of $XDG_CONFIG_HOME/pqadapter/night-light.conf,
+ * /etc/pqadapter/night-light.conf and
+ * /usr/share/pqadapter/night-light/<device>.conf is used. Its
+ * [NightLight] group holds a Points list of Kelvin:strength pairs, e.g.
+ * "Points=1700:300;2700:200;4700:0". The points are interpolated
+ * linearly and clamped past the first and last one. Without a usable
+ * file the built-in curve is used.
+ *
+ * @param device The device codename, or NULL to skip the per-device file.
+ * @return A new calibration, free it with calibration_free().
+ */
+Calibration *calibration_load(const char *device);
+
+/**
+ * Free a calibration.
+ *
+ * @param calibration The calibration to free, may be NULL.
+ */
+void calibration_free(Calibration *calibration);
+
+/**
+ * Get where a calibration was loaded from.
+ *
+ * @param calibration The calibration.
+ * @return The path of the file, or NULL for the built-in curve.
+ */
+const char *calibration_source(const Calibration *calibration);
+
+/**
+ * Map a night light temperature to a blue light strength.
+ *
+ * @param calibration The calibration.
+ * @param kelvin The night light temperature, clamped to the table.
+ * @return The blue light strength.
+ */
+int calibration_strength(const Calibration *calibration, guint32 kelvin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CALIBRATION_H
@@ -6,7 +6,14 @@
 
 #include "pq.h"
 #include "alsa.h"
+#include "als.h"
+#include "calibration.h"
+#include "units.h"
+#include "services.h"
+#include "registry.h"
 #include <gio/gio.h>
+#include <glib-unix.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +21,13 @@
 #include <unistd.h>
 #include <hybris/properties/properties.h>
 
+/* Night light strength updates are applied at most once per frame */
+#define NIGHT_LIGHT_FRAME_MS 16
+/* and faded to, so the panel doesn't visibly jump */
+#define NIGHT_LIGHT_FADE_MS 400
+/* How long init gets to start or stop a service */
+#define SERVICE_WAIT_MS 5000
+
 typedef struct {
     GSettings *settings_color;
     GSettings *settings_privacy;
@@ -21,14 +35,42 @@ typedef struct {
     GSettings *settings_pq;
     GMainLoop *main_loop;
     PQContext *pq_ctx;
+    gboolean pq_restored;
+
+    /* Night light temperature coalescing, see queue_blue_light_strength() */
+    guint strength_timer_id;
+    gboolean strength_pending;
+    int pending_strength;
+    guint strength_dropped;
+    int strength_target;
+
+    Calibration *calibration;
+    AlsaMixer *mixer;
+    UnitControl *units;
+    ServiceTracker *services;
+    RegistryCache *registry;
+
+    /* Ambient light only matters to chameleon while the panel is lit */
+    Als *als;
+    GDBusProxy *display_config;
+    gboolean screen_on;
+} AppSettings;
 
-    guint32 original_min_temperature;
-    guint32 original_max_temperature;
-    guint32 scale_min;
-    guint32 scale_max;
+static Calibration *
+load_calibration(void)
+{
+    char device[PROP_VALUE_MAX];
+    Calibration *calibration;
 
-    const char *pq_keys[20];
-} AppSettings;
+    property_get("ro.product.vendor.device", device, "");
+    if (!device[0])
+        property_get("ro.product.device", device, "");
+
+    calibration = calibration_load(device);
+    g_print("Night Light calibration: %s\n",
+            calibration_source(calibration) ? calibration_source(calibration) : "built-in");
+    return calibration;
+}
 
 static AppSettings *
 init_app_settings()
@@ -37,7 +79,8 @@ init_app_settings()
     if (!settings)
         return NULL;
 
-    settings->pq_ctx = init_pq_hidl();
+    /* The HAL may register after us, don't hold up the session for it */
+    settings->pq_ctx = pq_context_new();
     if (!settings->pq_ctx) {
         free(settings);
         return NULL;
@@ -48,40 +91,106 @@ init_app_settings()
     settings->settings_location = g_settings_new("org.gnome.system.location");
     settings->settings_pq = g_settings_new("io.furios.pq");
     settings->main_loop = NULL;
+    settings->pq_restored = FALSE;
+    settings->strength_timer_id = 0;
+    settings->strength_pending = FALSE;
+    settings->pending_strength = 0;
+    settings->strength_dropped = 0;
+    settings->strength_target = 0;
+
+    settings->calibration = load_calibration();
+    settings->mixer = alsa_mixer_open("default");
+    settings->units = unit_control_new();
+    settings->services = service_tracker_new();
+    settings->registry = registry_cache_new();
+    settings->als = NULL;
+    settings->display_config = NULL;
+    settings->screen_on = TRUE;
+
+    return settings;
+}
 
-    settings->original_min_temperature = 1700;
-    settings->original_max_temperature = 4700;
-    settings->scale_min = 0;
-    settings->scale_max = 1000;
-
-    static const char *keys[] = {
-        "pq-mode",
-        "blue-light",
-        "blue-light-strength",
-        "chameleon",
-        "chameleon-strength",
-        "gamma-index",
-        "display-color",
-        "content-color",
-        "content-color-video",
-        "sharpness",
-        "dynamic-contrast",
-        "dynamic-sharpness",
-        "display-ccorr",
-        "display-gamma",
-        "display-over-drive",
-        "iso-adaptive-sharpness",
-        "ultra-resolution",
-        "video-hdr",
-        "global-pq-switch",
-        "global-pq-strength"
-    };
-
-    for (int i = 0; i < 20; i++) {
-        settings->pq_keys[i] = keys[i];
+static void
+on_pq_setting_applied(GObject *source,
+                      GAsyncResult *result,
+                      gpointer data)
+{
+    const char *key = data;
+    GError *error = NULL;
+    int ret = pq_set_setting_finish(result, &error);
+
+    if (error) {
+        g_printerr("Failed to apply %s: %s\n", key, error->message);
+        g_error_free(error);
+    } else if (ret != 0) {
+        g_printerr("Failed to apply %s, PQ returned %d\n", key, ret);
     }
+}
 
-    return settings;
+static void
+apply_pq_setting(AppSettings *app_settings,
+                 const int setting,
+                 const int value)
+{
+    pq_set_setting_async(app_settings->pq_ctx, setting, value, 5 /* step */,
+                         app_settings->settings_pq, NULL,
+                         on_pq_setting_applied, (gpointer)pq_setting_key(setting));
+}
+
+static void
+apply_blue_light_strength(AppSettings *app_settings,
+                          int strength)
+{
+    g_print("Night Light temperature mapped: %d\n", strength);
+    app_settings->strength_target = strength;
+    pq_transition_start(app_settings->pq_ctx, PQ_SETTING_BLUE_LIGHT_STRENGTH, strength,
+                        NIGHT_LIGHT_FADE_MS, PQ_EASE_OUT, app_settings->settings_pq);
+}
+
+static gboolean
+on_strength_frame(gpointer data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+
+    if (app_settings->strength_pending) {
+        app_settings->strength_pending = FALSE;
+        apply_blue_light_strength(app_settings, app_settings->pending_strength);
+        return G_SOURCE_CONTINUE;
+    }
+
+    /* A frame without changes, the burst is over */
+    if (app_settings->strength_dropped) {
+        g_print("Night Light: coalesced %u intermediate temperature updates\n",
+                app_settings->strength_dropped);
+        app_settings->strength_dropped = 0;
+    }
+
+    app_settings->strength_timer_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Dragging the temperature slider emits far more changes than the panel
+ * can show. The first change is applied right away, later ones within
+ * the same frame only replace the pending value, which is applied when
+ * the frame ends. The last value always lands.
+ */
+static void
+queue_blue_light_strength(AppSettings *app_settings,
+                          int strength)
+{
+    if (!app_settings->strength_timer_id) {
+        apply_blue_light_strength(app_settings, strength);
+        app_settings->strength_timer_id = g_timeout_add(NIGHT_LIGHT_FRAME_MS,
+                                                        on_strength_frame, app_settings);
+        return;
+    }
+
+    if (app_settings->strength_pending)
+        app_settings->strength_dropped++;
+
+    app_settings->pending_strength = strength;
+    app_settings->strength_pending = TRUE;
 }
 
 static void
@@ -93,10 +202,7 @@ on_night_light_enabled(GSettings *settings,
     gboolean night_light_enabled = g_settings_get_boolean(settings, key);
     g_print("Current Night Light setting: %s\n", night_light_enabled ? "enabled" : "disabled");
 
-    if (night_light_enabled)
-        enable_blue_light_hidl(app_settings->pq_ctx->client, 1, 5 /* step */, app_settings->settings_pq);
-    else
-        enable_blue_light_hidl(app_settings->pq_ctx->client, 0, 5 /* step */, app_settings->settings_pq);
+    apply_pq_setting(app_settings, PQ_SETTING_BLUE_LIGHT, night_light_enabled ? 1 : 0);
 }
 
 static void
@@ -110,40 +216,83 @@ on_night_light_temperature_changed(GSettings *settings,
     if (night_light_enabled) {
         guint32 temperature = g_settings_get_uint(settings, key);
 
-        guint32 reversed_temperature = app_settings->original_max_temperature -
-                                     (temperature - app_settings->original_min_temperature);
+        queue_blue_light_strength(app_settings, calibration_strength(app_settings->calibration, temperature));
+    }
+}
+
+/*
+ * Something else (PipeWire, alsactl, a UCM verb) may flip Capture back
+ * on, so the privacy setting wins whenever the switch changes.
+ */
+static void
+on_capture_changed(AlsaMixer *mixer,
+                   const char *selem_name,
+                   void *data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+    int wanted = g_settings_get_boolean(app_settings->settings_privacy, "disable-microphone") ? 0 : 1;
+    int capture = alsa_mixer_get_capture_state(mixer, selem_name);
+
+    if (capture < 0 || capture == wanted)
+        return;
+
+    g_print("Mixer '%s' capture was turned %s, restoring\n", selem_name, capture ? "on" : "off");
+    alsa_mixer_set_capture_state(mixer, selem_name, wanted);
+}
 
-        double scaled_temperature = (double)(reversed_temperature - app_settings->original_min_temperature) *
-                                  (app_settings->scale_max - app_settings->scale_min) /
-                                  (app_settings->original_max_temperature - app_settings->original_min_temperature) +
-                                  app_settings->scale_min;
-        scaled_temperature = scaled_temperature * 0.3;
+static gboolean
+service_wait_done(GAsyncResult *result,
+                  const char *what)
+{
+    GError *error = NULL;
 
-        g_print("Night Light temperature mapped: %.0f \n", scaled_temperature);
-        set_blue_light_strength_hidl(app_settings->pq_ctx->client,
-                                     (int)scaled_temperature,
-                                     5 /* step */,
-                                     app_settings->settings_pq);
+    if (!service_tracker_wait_finish(result, &error)) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr("%s: %s\n", what, error->message);
+        g_error_free(error);
+        return FALSE;
     }
+
+    return TRUE;
 }
 
 static void
-clear_directory(const char *path)
+on_camera_stopped(GObject *source,
+                  GAsyncResult *result,
+                  gpointer data)
 {
-    DIR *dir = opendir(path);
-    if (dir) {
-        struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
-            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-                continue;
-            char full_path[512];
-            snprintf(full_path, sizeof(full_path), "%s/%s", path, entry->d_name);
-            remove(full_path);
-        }
-        closedir(dir);
-        rmdir(path);
-        g_print("GStreamer cache cleared.\n");
-    }
+    if (service_wait_done(result, "Failed to stop the camera HAL server"))
+        g_print("Camera HAL server stopped.\n");
+}
+
+static void
+on_camera_started(GObject *source,
+                  GAsyncResult *result,
+                  gpointer data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+
+    if (!service_wait_done(result, "Failed to start the camera HAL server"))
+        return;
+
+    g_print("Camera HAL server started.\n");
+    /* Camera plugins blacklisted while the HAL was down get scanned again */
+    registry_cache_invalidate(app_settings->registry);
+}
+
+static void
+on_gnss_started(GObject *source,
+                GAsyncResult *result,
+                gpointer data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+
+    if (!service_wait_done(result, "Failed to start the GNSS service"))
+        return;
+
+    g_print("GNSS service started.\n");
+    /* geoclue only picks up the GNSS HAL when it starts */
+    unit_control_restart(app_settings->units, "geoclue.service");
 }
 
 static void
@@ -156,25 +305,17 @@ on_privacy_setting_changed(GSettings *settings,
     g_print("Privacy setting '%s' changed to: %s\n", key, setting_value ? "true" : "false");
 
     if (g_strcmp0(key, "disable-microphone") == 0) {
-        set_capture_state("default", "Capture", setting_value ? 0 : 1);
+        if (app_settings->mixer)
+            alsa_mixer_set_capture_state(app_settings->mixer, "Capture", setting_value ? 0 : 1);
     } else if (g_strcmp0(key, "disable-camera") == 0) {
-        char service_state[PROP_VALUE_MAX];
         if (setting_value) {
-            if (property_get("init.svc.camerahalserver", service_state, "stopped") &&
-                strcmp(service_state, "running") == 0) {
-                property_set("ctl.stop", "camerahalserver");
-                g_print("Camera HAL server stopped.\n");
-            }
+            if (service_tracker_request(app_settings->services, "camerahalserver", SERVICE_STATE_STOPPED))
+                service_tracker_wait_async(app_settings->services, "camerahalserver", SERVICE_STATE_STOPPED,
+                                           SERVICE_WAIT_MS, on_camera_stopped, app_settings);
         } else {
-            if (property_get("init.svc.camerahalserver", service_state, "running") &&
-                strcmp(service_state, "stopped") == 0) {
-                property_set("ctl.start", "camerahalserver");
-                g_print("Camera HAL server started.\n");
-
-                char cache_dir[512];
-                snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/gstreamer-1.0", getenv("HOME"));
-                clear_directory(cache_dir);
-            }
+            if (service_tracker_request(app_settings->services, "camerahalserver", SERVICE_STATE_RUNNING))
+                service_tracker_wait_async(app_settings->services, "camerahalserver", SERVICE_STATE_RUNNING,
+                                           SERVICE_WAIT_MS, on_camera_started, app_settings);
         }
     }
 }
@@ -188,114 +329,174 @@ on_location_setting_changed(GSettings *settings,
     gboolean setting_value = g_settings_get_boolean(settings, key);
     g_print("Location setting '%s' changed to: %s\n", key, setting_value ? "true" : "false");
 
-    char service_state[PROP_VALUE_MAX];
     if (setting_value) {
-        if (property_get("init.svc.vendor.gnss-default", service_state, "running") &&
-            strcmp(service_state, "stopped") == 0) {
-            property_set("ctl.start", "vendor.gnss-default");
-            g_print("GNSS service started.\n");
-            system("systemctl restart geoclue");
-        }
+        if (service_tracker_request(app_settings->services, "vendor.gnss-default", SERVICE_STATE_RUNNING))
+            service_tracker_wait_async(app_settings->services, "vendor.gnss-default", SERVICE_STATE_RUNNING,
+                                       SERVICE_WAIT_MS, on_gnss_started, app_settings);
     } else {
-        if (property_get("init.svc.vendor.gnss-default", service_state, "stopped") &&
-            strcmp(service_state, "running") == 0) {
-            property_set("ctl.stop", "vendor.gnss-default");
-            g_print("GNSS service stopped.\n");
-            system("systemctl stop geoclue");
+        if (service_tracker_request(app_settings->services, "vendor.gnss-default", SERVICE_STATE_STOPPED)) {
+            g_print("GNSS service stopping.\n");
+            unit_control_stop(app_settings->units, "geoclue.service");
         }
     }
 }
 
 static void
-pq_gsettings_init(AppSettings *app_settings)
+on_pq_settings_synced(GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
 {
+    GError *error = NULL;
+    int applied = pq_sync_settings_finish(result, &error);
+
+    if (error) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr("Failed to restore PQ settings: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_print("Restoring %d of %d PQ settings\n", applied, PQ_SETTING_MAX - 1);
+}
+
+static void
+on_pq_connected(PQContext *pq_ctx,
+                gpointer user_data)
+{
+    AppSettings *app_settings = (AppSettings*)user_data;
+
+    /* A restarted HAL has no ambient reading */
+    als_invalidate(app_settings->als);
+
+    /* Later restarts are covered by the context's own replay */
+    if (app_settings->pq_restored)
+        return;
+    app_settings->pq_restored = TRUE;
+
     if (!app_settings->settings_pq) {
         fprintf(stderr, "Failed to initialize GSettings\n");
         return;
     }
 
-    for (int i = 0; i < 20; i++) {
-        int mode = g_settings_get_int(app_settings->settings_pq, app_settings->pq_keys[i]);
-        g_print("Setting %s to %d\n", app_settings->pq_keys[i], mode);
-
-        switch (i + 1) {
-            case 1:
-                set_pq_mode_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 2:
-                enable_blue_light_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 3:
-                set_blue_light_strength_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 4:
-                enable_chameleon_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 5:
-                set_chameleon_strength_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 6:
-                set_gamma_index_hidl(app_settings->pq_ctx->client, mode, 5 /* step */, app_settings->settings_pq);
-                break;
-            case 7:
-                set_feature_display_color_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 8:
-                set_feature_content_color_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 9:
-                set_feature_content_color_video_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 10:
-                set_feature_sharpness_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 11:
-                set_feature_dynamic_contrast_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 12:
-                set_feature_dynamic_sharpness_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 13:
-                set_feature_display_ccorr_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 14:
-                set_feature_display_gamma_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 15:
-                set_feature_display_over_drive_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 16:
-                set_feature_iso_adaptive_sharpness_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 17:
-                set_feature_ultra_resolution_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 18:
-                set_feature_video_hdr_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 19:
-                set_global_pq_switch_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-            case 20:
-                set_global_pq_strength_hidl(app_settings->pq_ctx->client, mode, app_settings->settings_pq);
-                break;
-        }
+    pq_sync_settings_async(app_settings->pq_ctx, app_settings->settings_pq, 5 /* step */,
+                           NULL, on_pq_settings_synced, NULL);
+}
+
+static void
+update_als_state(AppSettings *app_settings)
+{
+    gboolean chameleon = app_settings->settings_pq &&
+                         g_settings_get_int(app_settings->settings_pq, "chameleon") != 0;
+
+    als_set_active(app_settings->als, app_settings->screen_on && chameleon);
+}
+
+static void
+on_chameleon_changed(GSettings *settings,
+                     gchar *key,
+                     gpointer data)
+{
+    update_als_state((AppSettings*)data);
+}
+
+/* Mutter's PowerSaveMode is 0 while the panel is on, anything else is off */
+static void
+update_screen_state(AppSettings *app_settings)
+{
+    GVariant *mode = g_dbus_proxy_get_cached_property(app_settings->display_config, "PowerSaveMode");
+
+    app_settings->screen_on = !mode || g_variant_get_int32(mode) == 0;
+    if (mode)
+        g_variant_unref(mode);
+
+    update_als_state(app_settings);
+}
+
+static void
+on_display_config_properties_changed(GDBusProxy *proxy,
+                                     GVariant *changed,
+                                     GStrv invalidated,
+                                     gpointer data)
+{
+    update_screen_state((AppSettings*)data);
+}
+
+static void
+on_display_config_ready(GObject *source,
+                        GAsyncResult *result,
+                        gpointer data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+    GError *error = NULL;
+
+    app_settings->display_config = g_dbus_proxy_new_for_bus_finish(result, &error);
+    if (!app_settings->display_config) {
+        fprintf(stderr, "Failed to watch the display state: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    g_signal_connect(app_settings->display_config, "g-properties-changed",
+                     G_CALLBACK(on_display_config_properties_changed), app_settings);
+    update_screen_state(app_settings);
+}
+
+static void
+on_bus_acquired(GDBusConnection *connection,
+                const gchar *name,
+                gpointer user_data)
+{
+    GError *error = NULL;
+
+    if (!pq_stats_export(connection, "/io/FuriOS/PQ/Adapter", &error)) {
+        fprintf(stderr, "Failed to export PQ stats: %s\n", error->message);
+        g_error_free(error);
     }
 }
 
+static gboolean
+on_quit_signal(gpointer data)
+{
+    AppSettings *app_settings = (AppSettings*)data;
+
+    g_main_loop_quit(app_settings->main_loop);
+    return G_SOURCE_CONTINUE;
+}
+
 static void
 cleanup_app_settings(AppSettings *settings)
 {
+    if (settings->strength_timer_id)
+        g_source_remove(settings->strength_timer_id);
+    /* The loop is gone, don't lose the final value of a burst or fade */
+    if (settings->strength_pending)
+        settings->strength_target = settings->pending_strength;
+    if (settings->strength_pending ||
+        pq_transition_active(settings->pq_ctx, PQ_SETTING_BLUE_LIGHT_STRENGTH))
+        pq_set_setting(settings->pq_ctx, PQ_SETTING_BLUE_LIGHT_STRENGTH,
+                       settings->strength_target, 5 /* step */, settings->settings_pq);
     if (settings->settings_color)
         g_object_unref(settings->settings_color);
     if (settings->settings_privacy)
         g_object_unref(settings->settings_privacy);
     if (settings->settings_location)
         g_object_unref(settings->settings_location);
-    if (settings->settings_pq)
+    als_free(settings->als);
+    alsa_mixer_close(settings->mixer);
+    unit_control_free(settings->units);
+    service_tracker_free(settings->services);
+    registry_cache_free(settings->registry);
+    if (settings->display_config)
+        g_object_unref(settings->display_config);
+    if (settings->pq_ctx)
+        cleanup_pq_hidl(settings->pq_ctx);
+    if (settings->settings_pq) {
+        pq_settings_flush(settings->settings_pq);
         g_object_unref(settings->settings_pq);
+    }
     if (settings->main_loop)
         g_main_loop_unref(settings->main_loop);
+    calibration_free(settings->calibration);
     free(settings);
 }
 
@@ -303,8 +504,13 @@ int
 main(int argc, char **argv)
 {
     AppSettings *app_settings = init_app_settings();
+    if (!app_settings) {
+        fprintf(stderr, "Failed to initialize PQ context\n");
+        return 1;
+    }
 
-    pq_gsettings_init(app_settings);
+    /* Stored PQ settings are restored once the HAL shows up */
+    pq_set_reconnect_func(app_settings->pq_ctx, on_pq_connected, app_settings);
 
     if (app_settings->settings_color) {
         on_night_light_enabled(app_settings->settings_color, "night-light-enabled", app_settings);
@@ -316,7 +522,23 @@ main(int argc, char **argv)
                          G_CALLBACK(on_night_light_temperature_changed), app_settings);
     }
 
+    /* Feed chameleon from the ambient colour sensor, if there is one */
+    app_settings->als = als_new(app_settings->pq_ctx);
+    if (app_settings->als && app_settings->settings_pq) {
+        g_signal_connect(app_settings->settings_pq, "changed::chameleon",
+                         G_CALLBACK(on_chameleon_changed), app_settings);
+        g_dbus_proxy_new_for_bus(G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START,
+                                 NULL, "org.gnome.Mutter.DisplayConfig",
+                                 "/org/gnome/Mutter/DisplayConfig", "org.gnome.Mutter.DisplayConfig",
+                                 NULL, on_display_config_ready, app_settings);
+        update_als_state(app_settings);
+    }
+
     if (app_settings->settings_privacy) {
+        if (app_settings->mixer && alsa_mixer_watch(app_settings->mixer, "Capture",
+                                                    on_capture_changed, app_settings) == 0)
+            on_capture_changed(app_settings->mixer, "Capture", app_settings);
+
         g_signal_connect(app_settings->settings_privacy, "changed::disable-camera",
                          G_CALLBACK(on_privacy_setting_changed), app_settings);
         g_signal_connect(app_settings->settings_privacy, "changed::disable-microphone",
@@ -330,9 +552,19 @@ main(int argc, char **argv)
                          G_CALLBACK(on_location_setting_changed), app_settings);
     }
 
+    /* Only used to publish HAL call statistics */
+    guint owner_id = g_bus_own_name(G_BUS_TYPE_SESSION, "io.FuriOS.PQ.Adapter",
+                                    G_BUS_NAME_OWNER_FLAGS_NONE, on_bus_acquired,
+                                    NULL, NULL, app_settings, NULL);
+
     app_settings->main_loop = g_main_loop_new(NULL, FALSE);
-    if (app_settings->main_loop)
+    if (app_settings->main_loop) {
+        g_unix_signal_add(SIGTERM, on_quit_signal, app_settings);
+        g_unix_signal_add(SIGINT, on_quit_signal, app_settings);
         g_main_loop_run(app_settings->main_loop);
+    }
+
+    g_bus_unown_name(owner_id);
 
     cleanup_app_settings(app_settings);
     return 0;
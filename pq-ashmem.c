@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Direct access to the shared memory region of the PQ HAL. The region
+ * is fetched once and mapped, so walking a table costs no binder
+ * transaction per field the way getTuningField does.
+ */
+
+#include "pq-ashmem.h"
+#include "pq-transport.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct _PQAshmem {
+    guint8 *data;
+    gsize size;
+    gboolean writable;
+};
+
+/* offset and len describe a range inside the region */
+static gboolean
+pq_ashmem_contains(const PQAshmem *ashmem,
+                   const gsize offset,
+                   const gsize len)
+{
+    return ashmem && offset <= ashmem->size && len <= ashmem->size - offset;
+}
+
+PQAshmem *
+pq_ashmem_map(PQContext* ctx,
+              gboolean writable)
+{
+    PQAshmem *ashmem;
+    void *data = MAP_FAILED;
+    guint64 size = 0;
+    int fd = -1;
+
+    if (!ctx || !ctx->connected || !ctx->transport->get_ashmem)
+        return NULL;
+
+    if (ctx->transport->get_ashmem(ctx, &fd, &size) != 0)
+        return NULL;
+
+    if (size == 0 || size > G_MAXSIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    /* The HAL may have dropped PROT_WRITE from the region, read it anyway */
+    if (writable)
+        data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        writable = FALSE;
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        g_debug("Failed to map the PQ shared memory: %s", g_strerror(errno));
+        return NULL;
+    }
+
+    ashmem = g_new0(PQAshmem, 1);
+    ashmem->data = data;
+    ashmem->size = size;
+    ashmem->writable = writable;
+    return ashmem;
+}
+
+void
+pq_ashmem_unmap(PQAshmem *ashmem)
+{
+    if (!ashmem)
+        return;
+
+    munmap(ashmem->data, ashmem->size);
+    g_free(ashmem);
+}
+
+gsize
+pq_ashmem_get_size(const PQAshmem *ashmem)
+{
+    return ashmem ? ashmem->size : 0;
+}
+
+gboolean
+pq_ashmem_is_writable(const PQAshmem *ashmem)
+{
+    return ashmem && ashmem->writable;
+}
+
+const void *
+pq_ashmem_get_data(const PQAshmem *ashmem)
+{
+    return ashmem ? ashmem->data : NULL;
+}
+
+gboolean
+pq_ashmem_read(const PQAshmem *ashmem,
+               const gsize offset,
+               void *dest,
+               const gsize len)
+{
+    if (!dest || !pq_ashmem_contains(ashmem, offset, len))
+        return FALSE;
+
+    memcpy(dest, ashmem->data + offset, len);
+    return TRUE;
+}
+
+gboolean
+pq_ashmem_read_u32(const PQAshmem *ashmem,
+                   const gsize offset,
+                   guint32 *value)
+{
+    if (!value || offset % sizeof(guint32) || !pq_ashmem_contains(ashmem, offset, sizeof(guint32)))
+        return FALSE;
+
+    /* The HAL writes concurrently, an aligned load sees a whole register */
+    *value = __atomic_load_n((const guint32*)(ashmem->data + offset), __ATOMIC_RELAXED);
+    return TRUE;
+}
+
+gboolean
+pq_ashmem_write_u32(PQAshmem *ashmem,
+                    const gsize offset,
+                    const guint32 value)
+{
+    if (!pq_ashmem_is_writable(ashmem) || offset % sizeof(guint32) ||
+        !pq_ashmem_contains(ashmem, offset, sizeof(guint32)))
+        return FALSE;
+
+    __atomic_store_n((guint32*)(ashmem->data + offset), value, __ATOMIC_RELAXED);
+    return TRUE;
+}
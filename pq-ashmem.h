@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef PQ_ASHMEM_H
+#define PQ_ASHMEM_H
+
+#include "pq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _PQAshmem PQAshmem;
+
+/**
+ * Map the shared memory region of the HAL
+ *
+ * Fetches the region with one getAshmem call, after which reads and
+ * writes go straight to memory. The layout of the region is up to the
+ * vendor HAL. A restarted HAL hands out a new region, map it again from
+ * the reconnect callback.
+ *
+ * @param ctx PQContext to fetch the region through
+ * @param writable Map read-write if the HAL allows it, see pq_ashmem_is_writable()
+ * @return New mapping, NULL if not connected or the HAL has no region
+ */
+PQAshmem *pq_ashmem_map(PQContext* ctx,
+                        gboolean writable);
+
+/**
+ * Unmap a region
+ *
+ * @param ashmem Mapping to release, may be NULL
+ */
+void pq_ashmem_unmap(PQAshmem *ashmem);
+
+/**
+ * Get the size of a mapped region
+ *
+ * @param ashmem Mapping to query
+ * @return size in bytes
+ */
+gsize pq_ashmem_get_size(const PQAshmem *ashmem);
+
+/**
+ * Check whether a region was mapped read-write
+ *
+ * @param ashmem Mapping to query
+ * @return TRUE if writes are possible, FALSE for a read-only mapping
+ */
+gboolean pq_ashmem_is_writable(const PQAshmem *ashmem);
+
+/**
+ * Get the start of a mapped region, for walking whole tables
+ *
+ * The HAL may change the contents at any time.
+ *
+ * @param ashmem Mapping to query
+ * @return pointer valid until pq_ashmem_unmap()
+ */
+const void *pq_ashmem_get_data(const PQAshmem *ashmem);
+
+/**
+ * Copy a range out of a region
+ *
+ * @param ashmem Mapping to read
+ * @param offset Byte offset into the region
+ * @param dest Buffer of at least len bytes
+ * @param len Number of bytes to copy
+ * @return TRUE on success, FALSE if the range is outside the region
+ */
+gboolean pq_ashmem_read(const PQAshmem *ashmem,
+                        const gsize offset,
+                        void *dest,
+                        const gsize len);
+
+/**
+ * Read a 32 bit register
+ *
+ * @param ashmem Mapping to read
+ * @param offset Byte offset into the region, a multiple of 4
+ * @param value Return location for the value
+ * @return TRUE on success, FALSE if offset is misaligned or outside the region
+ */
+gboolean pq_ashmem_read_u32(const PQAshmem *ashmem,
+                            const gsize offset,
+                            guint32 *value);
+
+/**
+ * Write a 32 bit register
+ *
+ * @param ashmem Read-write mapping
+ * @param offset Byte offset into the region, a multiple of 4
+ * @param value Value to store
+ * @return TRUE on success, FALSE if the mapping is read-only or offset is misaligned or outside the region
+ */
+gboolean pq_ashmem_write_u32(PQAshmem *ashmem,
+                             const gsize offset,
+                             const guint32 value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PQ_ASHMEM_H
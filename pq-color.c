@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Colour transform composition. Every effect is a 4x4 matrix, and the
+ * display gets their product in a single setColorTransform call instead
+ * of one HAL feature per effect. Rows are multiplied as four-wide float
+ * vectors, which GCC lowers to SSE or NEON.
+ */
+
+#include "pq-color.h"
+#include <string.h>
+
+/* android.hardware.graphics.common ColorTransform */
+#define PQ_COLOR_HINT_IDENTITY 0
+#define PQ_COLOR_HINT_ARBITRARY_MATRIX 1
+
+/* Rec. 709 luma weights */
+#define PQ_LUMA_R 0.2126f
+#define PQ_LUMA_G 0.7152f
+#define PQ_LUMA_B 0.0722f
+
+typedef gfloat PQVec4 __attribute__((vector_size(4 * sizeof(gfloat))));
+
+struct _PQColorCompositor {
+    PQContext* ctx;
+    gfloat layers[PQ_COLOR_LAYER_MAX][PQ_COLOR_MATRIX_SIZE];
+    gboolean active[PQ_COLOR_LAYER_MAX];
+    gfloat sent[PQ_COLOR_MATRIX_SIZE];
+    gboolean sent_valid;
+};
+
+void
+pq_color_matrix_identity(gfloat *out)
+{
+    memset(out, 0, PQ_COLOR_MATRIX_SIZE * sizeof(gfloat));
+    for (int i = 0; i < 4; i++)
+        out[i * 5] = 1.0f;
+}
+
+void
+pq_color_matrix_gains(gfloat *out,
+                      const gfloat r,
+                      const gfloat g,
+                      const gfloat b)
+{
+    pq_color_matrix_identity(out);
+    out[0] = r;
+    out[5] = g;
+    out[10] = b;
+}
+
+void
+pq_color_matrix_saturation(gfloat *out,
+                           const gfloat saturation)
+{
+    const gfloat luma[3] = { PQ_LUMA_R, PQ_LUMA_G, PQ_LUMA_B };
+
+    pq_color_matrix_identity(out);
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 3; col++)
+            out[row * 4 + col] = (1.0f - saturation) * luma[col] + (row == col ? saturation : 0.0f);
+    }
+}
+
+void
+pq_color_matrix_multiply(const gfloat *a,
+                         const gfloat *b,
+                         gfloat *out)
+{
+    PQVec4 rows[4], result[4];
+
+    memcpy(rows, b, sizeof(rows));
+    for (int i = 0; i < 4; i++) {
+        result[i] = a[i * 4 + 0] * rows[0] + a[i * 4 + 1] * rows[1] +
+                    a[i * 4 + 2] * rows[2] + a[i * 4 + 3] * rows[3];
+    }
+    memcpy(out, result, sizeof(result));
+}
+
+PQColorCompositor *
+pq_color_compositor_new(PQContext* ctx)
+{
+    PQColorCompositor *compositor = g_new0(PQColorCompositor, 1);
+
+    compositor->ctx = ctx;
+    for (int i = 0; i < PQ_COLOR_LAYER_MAX; i++)
+        pq_color_matrix_identity(compositor->layers[i]);
+
+    return compositor;
+}
+
+void
+pq_color_compositor_free(PQColorCompositor *compositor)
+{
+    g_free(compositor);
+}
+
+void
+pq_color_compositor_set_layer(PQColorCompositor *compositor,
+                              const PQColorLayer layer,
+                              const gfloat *matrix)
+{
+    if (!compositor || layer < 0 || layer >= PQ_COLOR_LAYER_MAX)
+        return;
+
+    compositor->active[layer] = matrix != NULL;
+    if (matrix)
+        memcpy(compositor->layers[layer], matrix, sizeof(compositor->layers[layer]));
+    else
+        pq_color_matrix_identity(compositor->layers[layer]);
+}
+
+int
+pq_color_compositor_commit(PQColorCompositor *compositor,
+                           const int step)
+{
+    gfloat product[PQ_COLOR_MATRIX_SIZE];
+    gboolean identity = TRUE;
+    int retval;
+
+    if (!compositor)
+        return -1;
+
+    /* Later layers multiply from the left, the first layer touches the pixel first */
+    pq_color_matrix_identity(product);
+    for (int i = 0; i < PQ_COLOR_LAYER_MAX; i++) {
+        if (!compositor->active[i])
+            continue;
+        pq_color_matrix_multiply(compositor->layers[i], product, product);
+        identity = FALSE;
+    }
+
+    if (compositor->sent_valid && memcmp(product, compositor->sent, sizeof(product)) == 0)
+        return 0;
+
+    retval = pq_set_color_transform(compositor->ctx, product,
+                                    identity ? PQ_COLOR_HINT_IDENTITY : PQ_COLOR_HINT_ARBITRARY_MATRIX,
+                                    step);
+    if (retval == 0) {
+        memcpy(compositor->sent, product, sizeof(product));
+        compositor->sent_valid = TRUE;
+    }
+
+    return retval;
+}
+
+void
+pq_color_compositor_invalidate(PQColorCompositor *compositor)
+{
+    if (compositor)
+        compositor->sent_valid = FALSE;
+}
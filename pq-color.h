@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef PQ_COLOR_H
+#define PQ_COLOR_H
+
+#include "pq.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Colour effects, in the order they are applied to a pixel
+ */
+typedef enum {
+    /* Inversion, grayscale, colour blindness correction */
+    PQ_COLOR_LAYER_ACCESSIBILITY,
+    PQ_COLOR_LAYER_SATURATION,
+    /* Night light white point */
+    PQ_COLOR_LAYER_NIGHT_LIGHT,
+    /* User white balance, closest to the panel */
+    PQ_COLOR_LAYER_WHITE_BALANCE,
+    PQ_COLOR_LAYER_MAX
+} PQColorLayer;
+
+typedef struct _PQColorCompositor PQColorCompositor;
+
+/**
+ * Set a matrix to identity
+ *
+ * @param out PQ_COLOR_MATRIX_SIZE floats to fill
+ */
+void pq_color_matrix_identity(gfloat *out);
+
+/**
+ * Build a matrix scaling each channel, e.g. for a white point
+ *
+ * @param out PQ_COLOR_MATRIX_SIZE floats to fill
+ * @param r Red gain
+ * @param g Green gain
+ * @param b Blue gain
+ */
+void pq_color_matrix_gains(gfloat *out,
+                           const gfloat r,
+                           const gfloat g,
+                           const gfloat b);
+
+/**
+ * Build a saturation matrix around Rec. 709 luma
+ *
+ * @param out PQ_COLOR_MATRIX_SIZE floats to fill
+ * @param saturation 0 for grayscale, 1 for unchanged, above 1 to boost
+ */
+void pq_color_matrix_saturation(gfloat *out,
+                                const gfloat saturation);
+
+/**
+ * Multiply two matrices, the result applies b first and then a
+ *
+ * @param a Matrix applied second
+ * @param b Matrix applied first
+ * @param out PQ_COLOR_MATRIX_SIZE floats to fill, may be a or b
+ */
+void pq_color_matrix_multiply(const gfloat *a,
+                              const gfloat *b,
+                              gfloat *out);
+
+/**
+ * Create a compositor sending its product through a context
+ *
+ * @param ctx PQContext the combined transform is sent to
+ * @return New compositor with every layer at identity
+ */
+PQColorCompositor *pq_color_compositor_new(PQContext* ctx);
+
+/**
+ * Free a compositor, the last transform stays on the display
+ *
+ * @param compositor Compositor to free, may be NULL
+ */
+void pq_color_compositor_free(PQColorCompositor *compositor);
+
+/**
+ * Set the contribution of one layer, takes effect on the next commit
+ *
+ * @param compositor Compositor to change
+ * @param layer Layer to set
+ * @param matrix PQ_COLOR_MATRIX_SIZE floats, NULL to clear the layer
+ */
+void pq_color_compositor_set_layer(PQColorCompositor *compositor,
+                                   const PQColorLayer layer,
+                                   const gfloat *matrix);
+
+/**
+ * Multiply the active layers and send the product in one call, unless
+ * the HAL already holds it
+ *
+ * @param compositor Compositor to commit
+ * @param step Transition step count
+ * @return 0 on success or when nothing changed, PQ or transaction error code otherwise
+ */
+int pq_color_compositor_commit(PQColorCompositor *compositor,
+                               const int step);
+
+/**
+ * Forget what the HAL holds, so the next commit sends the product again.
+ * Not needed after a HAL restart, the context replays the last transform
+ * itself.
+ *
+ * @param compositor Compositor to invalidate
+ */
+void pq_color_compositor_invalidate(PQColorCompositor *compositor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PQ_COLOR_H
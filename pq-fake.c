@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * In-process stand-in for vendor.mediatek.hardware.pq@2.0::IPictureQuality.
+ * It keeps the state a real HAL would and answers every function libpq
+ * implements, so the daemons and tools run on machines without the
+ * vendor service. Latency, failures and HAL restarts can be injected.
+ */
+
+#define _GNU_SOURCE
+#include "pq.h"
+#include "pq-transport.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Generic failure as returned by the HAL, any non-zero code is an error to libpq */
+#define PQ_FAKE_ERROR 1
+/* Transaction status of a call to a dead binder object */
+#define PQ_FAKE_DEAD_OBJECT -32
+/* How long a simulated HAL restart takes */
+#define PQ_FAKE_RESTART_MS 200
+/* Size of the zeroed region getAshmem hands out */
+#define PQ_FAKE_ASHMEM_SIZE 4096
+
+typedef struct {
+    guint latency_us;
+    guint fail_every;
+    guint die_after;
+    guint calls;
+
+    gboolean registered;
+    gboolean watching;
+    guint lookup_id;
+    guint death_id;
+    guint restart_id;
+
+    gulong last_call_id;
+    GHashTable *queued;
+
+    /* IPictureQuality state */
+    gint32 color_region[5];
+    gint32 pq_mode;
+    gint32 tdshp_flag;
+    gint32 pq_index[5];
+    gint32 disp_scenario;
+    gint32 features[PQ_FEATURE_MAX];
+    gint32 blue_light;
+    gint32 blue_light_strength;
+    gint32 chameleon;
+    gint32 chameleon_strength;
+    GHashTable *tuning;
+    gdouble ambient_light_ct[3];
+    gint32 ambient_light_rgbw[4];
+    gint32 gamma_index;
+    gint32 external_panel_nits;
+    gfloat color_transform[PQ_COLOR_MATRIX_SIZE];
+    gint32 color_transform_hint;
+    gint32 rgb_gain[4];
+    gint32 global_pq_switch;
+    gint32 global_pq_strength;
+    gint32 global_pq_stable_status;
+    /* Created on the first getAshmem, -1 until then */
+    int ashmem_fd;
+} PQFake;
+
+typedef struct {
+    PQContext* ctx;
+    gulong id;
+    guint source_id;
+    int func;
+    PQArg args[PQ_MAX_ARGS];
+    PQTransportReplyFunc reply;
+    gpointer user_data;
+    GDestroyNotify destroy;
+    gint64 started;
+} PQFakeCall;
+
+static guint
+pq_fake_env(const char *name)
+{
+    const char *value = g_getenv(name);
+
+    return value ? (guint)g_ascii_strtoull(value, NULL, 10) : 0;
+}
+
+/* What a freshly started HAL reports */
+static void
+pq_fake_reset(PQFake* fake)
+{
+    memset(fake->color_region, 0, sizeof(fake->color_region));
+    memset(fake->pq_index, 0, sizeof(fake->pq_index));
+    memset(fake->ambient_light_ct, 0, sizeof(fake->ambient_light_ct));
+    memset(fake->ambient_light_rgbw, 0, sizeof(fake->ambient_light_rgbw));
+
+    fake->pq_mode = 0;
+    fake->tdshp_flag = 0;
+    fake->disp_scenario = 0;
+    for (int i = 0; i < PQ_FEATURE_MAX; i++)
+        fake->features[i] = 1;
+    fake->blue_light = 0;
+    fake->blue_light_strength = 0;
+    fake->chameleon = 0;
+    fake->chameleon_strength = 0;
+    g_hash_table_remove_all(fake->tuning);
+    fake->gamma_index = 0;
+    fake->external_panel_nits = 0;
+    memset(fake->color_transform, 0, sizeof(fake->color_transform));
+    for (int i = 0; i < 4; i++)
+        fake->color_transform[i * 5] = 1.0f;
+    fake->color_transform_hint = 0;
+    for (int i = 0; i < 4; i++)
+        fake->rgb_gain[i] = 1024;
+    fake->global_pq_switch = 0;
+    fake->global_pq_strength = 0;
+    fake->global_pq_stable_status = 0;
+    /* Mappings of the old region stay valid, a new one is handed out */
+    if (fake->ashmem_fd >= 0) {
+        close(fake->ashmem_fd);
+        fake->ashmem_fd = -1;
+    }
+}
+
+static gboolean
+pq_fake_restarted(gpointer user_data)
+{
+    PQContext* ctx = user_data;
+    PQFake* fake = ctx->transport_data;
+
+    fake->restart_id = 0;
+    fake->registered = TRUE;
+    if (fake->watching)
+        pq_transport_registered(ctx);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+pq_fake_notify_death(gpointer user_data)
+{
+    PQContext* ctx = user_data;
+    PQFake* fake = ctx->transport_data;
+
+    fake->death_id = 0;
+    pq_transport_died(ctx);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pq_fake_kill(PQContext* ctx)
+{
+    PQFake* fake = ctx->transport_data;
+
+    g_debug("Fake PQ HAL died after %u calls", fake->calls);
+
+    fake->registered = FALSE;
+    fake->calls = 0;
+    pq_fake_reset(fake);
+
+    /* Like binder, the death is reported from the main loop */
+    if (!fake->death_id)
+        fake->death_id = g_idle_add(pq_fake_notify_death, ctx);
+    if (!fake->restart_id)
+        fake->restart_id = g_timeout_add(PQ_FAKE_RESTART_MS, pq_fake_restarted, ctx);
+}
+
+static int
+pq_fake_tuning_get(PQFake* fake,
+                   const gint32 module,
+                   const gint32 field)
+{
+    gint64 key = ((gint64)module << 32) | (guint32)field;
+
+    return GPOINTER_TO_INT(g_hash_table_lookup(fake->tuning, &key));
+}
+
+static void
+pq_fake_tuning_set(PQFake* fake,
+                   const gint32 module,
+                   const gint32 field,
+                   const gint32 value)
+{
+    gint64 *key = g_new(gint64, 1);
+
+    *key = ((gint64)module << 32) | (guint32)field;
+    g_hash_table_replace(fake->tuning, key, GINT_TO_POINTER(value));
+}
+
+static int
+pq_fake_handle(PQContext* ctx,
+               const int func,
+               const PQArg* args,
+               gint32 *out)
+{
+    PQFake* fake = ctx->transport_data;
+
+    if (!fake->registered)
+        return PQ_FAKE_DEAD_OBJECT;
+
+    fake->calls++;
+    if (fake->die_after && fake->calls >= fake->die_after) {
+        pq_fake_kill(ctx);
+        return PQ_FAKE_DEAD_OBJECT;
+    }
+    if (fake->fail_every && fake->calls % fake->fail_every == 0)
+        return PQ_FAKE_ERROR;
+
+    switch (func) {
+        case SET_COLOR_REGION:
+            for (int i = 0; i < 5; i++)
+                fake->color_region[i] = args[i].i;
+            break;
+        case SET_PQ_MODE:
+            fake->pq_mode = args[0].i;
+            break;
+        case SET_TDSHP_FLAG:
+            fake->tdshp_flag = args[0].i;
+            break;
+        case GET_TDSHP_FLAG:
+            *out = fake->tdshp_flag;
+            break;
+        case SET_PQ_INDEX:
+            for (int i = 0; i < 5; i++)
+                fake->pq_index[i] = args[i].i;
+            break;
+        case SET_DISP_SCENARIO:
+            fake->disp_scenario = args[0].i;
+            break;
+        case SET_FEATURE_SWITCH:
+            if (args[0].i < 0 || args[0].i >= PQ_FEATURE_MAX)
+                return PQ_FAKE_ERROR;
+            fake->features[args[0].i] = args[1].i;
+            break;
+        case GET_FEATURE_SWITCH:
+            if (args[0].i < 0 || args[0].i >= PQ_FEATURE_MAX)
+                return PQ_FAKE_ERROR;
+            *out = fake->features[args[0].i];
+            break;
+        case ENABLE_BLUE_LIGHT:
+            fake->blue_light = args[0].i ? 1 : 0;
+            break;
+        case GET_BLUE_LIGHT_ENABLED:
+            *out = fake->blue_light;
+            break;
+        case SET_BLUE_LIGHT_STRENGTH:
+            fake->blue_light_strength = args[0].i;
+            break;
+        case GET_BLUE_LIGHT_STRENGTH:
+            *out = fake->blue_light_strength;
+            break;
+        case ENABLE_CHAMELEON:
+            fake->chameleon = args[0].i ? 1 : 0;
+            break;
+        case GET_CHAMELEON_ENABLED:
+            *out = fake->chameleon;
+            break;
+        case SET_CHAMELEON_STRENGTH:
+            fake->chameleon_strength = args[0].i;
+            break;
+        case GET_CHAMELEON_STRENGTH:
+            *out = fake->chameleon_strength;
+            break;
+        case SET_TUNING_FIELD:
+            pq_fake_tuning_set(fake, args[0].i, args[1].i, args[2].i);
+            break;
+        case GET_TUNING_FIELD:
+            *out = pq_fake_tuning_get(fake, args[0].i, args[1].i);
+            break;
+        case SET_AMBIENT_LIGHT_CT:
+            for (int i = 0; i < 3; i++)
+                fake->ambient_light_ct[i] = args[i].d;
+            break;
+        case SET_AMBIENT_LIGHT_RGBW:
+            for (int i = 0; i < 4; i++)
+                fake->ambient_light_rgbw[i] = args[i].i;
+            break;
+        case SET_GAMMA_INDEX:
+            fake->gamma_index = args[0].i;
+            break;
+        case GET_GAMMA_INDEX:
+            *out = fake->gamma_index;
+            break;
+        case SET_EXTERNAL_PANEL_NITS:
+            fake->external_panel_nits = args[0].i;
+            break;
+        case GET_EXTERNAL_PANEL_NITS:
+            *out = fake->external_panel_nits;
+            break;
+        case SET_COLOR_TRANSFORM:
+            if (!args[0].m)
+                return PQ_FAKE_ERROR;
+            memcpy(fake->color_transform, args[0].m, sizeof(fake->color_transform));
+            fake->color_transform_hint = args[1].i;
+            break;
+        case SET_RGB_GAIN:
+            for (int i = 0; i < 3; i++)
+                fake->rgb_gain[i] = args[i].i;
+            break;
+        case SET_GLOBAL_PQ_SWITCH:
+            fake->global_pq_switch = args[0].i;
+            break;
+        case GET_GLOBAL_PQ_SWITCH:
+            *out = fake->global_pq_switch;
+            break;
+        case SET_GLOBAL_PQ_STRENGTH:
+            fake->global_pq_strength = args[0].i;
+            break;
+        case GET_GLOBAL_PQ_STRENGTH:
+            *out = fake->global_pq_strength;
+            break;
+        case SET_GLOBAL_PQ_STABLE_STATUS:
+            fake->global_pq_stable_status = args[0].i;
+            break;
+        case GET_GLOBAL_PQ_STABLE_STATUS:
+            *out = fake->global_pq_stable_status;
+            break;
+        case GET_ASHMEM:
+            /* The region is created by pq_fake_get_ashmem() */
+            break;
+        default:
+            /* Not part of what libpq implements */
+            return PQ_FAKE_ERROR;
+    }
+
+    return 0;
+}
+
+static int
+pq_fake_execute(PQContext* ctx,
+                const int func,
+                const PQArg* args,
+                gint32 *out,
+                const gint64 started)
+{
+    int retval = pq_fake_handle(ctx, func, args, out);
+    PQStatsOutcome outcome = PQ_STATS_OK;
+
+    if (retval == PQ_FAKE_DEAD_OBJECT)
+        outcome = PQ_STATS_FAILED;
+    else if (retval != 0)
+        outcome = PQ_STATS_HAL_ERROR;
+
+    pq_stats_record(func, outcome, pq_stats_now() - started);
+    return retval;
+}
+
+static gboolean
+pq_fake_open(PQContext* ctx)
+{
+    PQFake* fake = g_new0(PQFake, 1);
+
+    fake->latency_us = pq_fake_env("PQ_FAKE_LATENCY_US");
+    fake->fail_every = pq_fake_env("PQ_FAKE_FAIL_EVERY");
+    fake->die_after = pq_fake_env("PQ_FAKE_DIE_AFTER");
+    fake->registered = TRUE;
+    fake->queued = g_hash_table_new(g_direct_hash, g_direct_equal);
+    fake->tuning = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    fake->ashmem_fd = -1;
+    pq_fake_reset(fake);
+
+    ctx->transport_data = fake;
+    return TRUE;
+}
+
+static void
+pq_fake_close(PQContext* ctx)
+{
+    PQFake* fake = ctx->transport_data;
+    GList *calls;
+
+    if (!fake)
+        return;
+
+    /* Removing the sources runs each call's destroy notify */
+    calls = g_hash_table_get_values(fake->queued);
+    g_hash_table_remove_all(fake->queued);
+    for (GList *l = calls; l; l = l->next)
+        g_source_remove(((PQFakeCall*)l->data)->source_id);
+    g_list_free(calls);
+
+    if (fake->lookup_id)
+        g_source_remove(fake->lookup_id);
+    if (fake->death_id)
+        g_source_remove(fake->death_id);
+    if (fake->restart_id)
+        g_source_remove(fake->restart_id);
+
+    g_hash_table_unref(fake->queued);
+    g_hash_table_unref(fake->tuning);
+    if (fake->ashmem_fd >= 0)
+        close(fake->ashmem_fd);
+    g_free(fake);
+    ctx->transport_data = NULL;
+}
+
+static gboolean
+pq_fake_connect(PQContext* ctx)
+{
+    PQFake* fake = ctx->transport_data;
+
+    return fake->registered;
+}
+
+static gboolean
+pq_fake_lookup_done(gpointer user_data)
+{
+    PQContext* ctx = user_data;
+    PQFake* fake = ctx->transport_data;
+
+    fake->lookup_id = 0;
+    pq_transport_found(ctx, fake->registered);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pq_fake_lookup(PQContext* ctx)
+{
+    PQFake* fake = ctx->transport_data;
+
+    fake->lookup_id = g_idle_add(pq_fake_lookup_done, ctx);
+}
+
+static void
+pq_fake_watch(PQContext* ctx,
+              gboolean watch)
+{
+    PQFake* fake = ctx->transport_data;
+
+    fake->watching = watch;
+}
+
+static void
+pq_fake_disconnect(PQContext* ctx)
+{
+    /* Nothing is held between calls */
+}
+
+static int
+pq_fake_call(PQContext* ctx,
+             int func,
+             const PQArg* args,
+             gint32 *out)
+{
+    PQFake* fake = ctx->transport_data;
+    gint64 started = pq_stats_now();
+
+    if (fake->latency_us)
+        g_usleep(fake->latency_us);
+
+    return pq_fake_execute(ctx, func, args, out, started);
+}
+
+static gboolean
+pq_fake_call_dispatch(gpointer user_data)
+{
+    PQFakeCall *call = user_data;
+    PQFake* fake = call->ctx->transport_data;
+    gint32 value = 0;
+    int retval;
+
+    g_hash_table_remove(fake->queued, GSIZE_TO_POINTER(call->id));
+    retval = pq_fake_execute(call->ctx, call->func, call->args, &value, call->started);
+    call->reply(call->ctx, retval, value, call->user_data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pq_fake_call_free(gpointer data)
+{
+    PQFakeCall *call = data;
+
+    if (call->destroy)
+        call->destroy(call->user_data);
+    g_free(call);
+}
+
+static gulong
+pq_fake_call_async(PQContext* ctx,
+                   int func,
+                   const PQArg* args,
+                   PQTransportReplyFunc reply,
+                   gpointer user_data,
+                   GDestroyNotify destroy)
+{
+    PQFake* fake = ctx->transport_data;
+    PQFakeCall *call = g_new0(PQFakeCall, 1);
+    const char *layout = pq_function_args(func);
+    gsize n_args = layout ? strlen(layout) : 0;
+
+    call->ctx = ctx;
+    call->id = ++fake->last_call_id;
+    call->func = func;
+    memcpy(call->args, args, MIN(n_args, PQ_MAX_ARGS) * sizeof(PQArg));
+    call->reply = reply;
+    call->user_data = user_data;
+    call->destroy = destroy;
+    call->started = pq_stats_now();
+
+    if (fake->latency_us >= 1000)
+        call->source_id = g_timeout_add_full(G_PRIORITY_DEFAULT, fake->latency_us / 1000,
+                                             pq_fake_call_dispatch, call, pq_fake_call_free);
+    else
+        call->source_id = g_idle_add_full(G_PRIORITY_DEFAULT, pq_fake_call_dispatch,
+                                          call, pq_fake_call_free);
+
+    g_hash_table_insert(fake->queued, GSIZE_TO_POINTER(call->id), call);
+    return call->id;
+}
+
+static void
+pq_fake_cancel(PQContext* ctx,
+               gulong id)
+{
+    PQFake* fake = ctx->transport_data;
+    PQFakeCall *call = g_hash_table_lookup(fake->queued, GSIZE_TO_POINTER(id));
+
+    if (!call)
+        return;
+
+    g_hash_table_remove(fake->queued, GSIZE_TO_POINTER(id));
+    g_source_remove(call->source_id);
+}
+
+static int
+pq_fake_get_ashmem(PQContext* ctx,
+                   int *fd,
+                   guint64 *size)
+{
+    PQFake* fake = ctx->transport_data;
+    gint32 value = 0;
+    int retval;
+
+    retval = pq_fake_call(ctx, GET_ASHMEM, NULL, &value);
+    if (retval != 0)
+        return retval;
+
+    if (fake->ashmem_fd < 0) {
+        fake->ashmem_fd = memfd_create("pq-fake-ashmem", MFD_CLOEXEC);
+        if (fake->ashmem_fd < 0)
+            return PQ_FAKE_ERROR;
+        if (ftruncate(fake->ashmem_fd, PQ_FAKE_ASHMEM_SIZE) < 0) {
+            close(fake->ashmem_fd);
+            fake->ashmem_fd = -1;
+            return PQ_FAKE_ERROR;
+        }
+    }
+
+    *fd = fcntl(fake->ashmem_fd, F_DUPFD_CLOEXEC, 0);
+    *size = PQ_FAKE_ASHMEM_SIZE;
+    return *fd < 0 ? PQ_FAKE_ERROR : 0;
+}
+
+const PQTransport pq_fake_transport = {
+    .name = "fake",
+    .open = pq_fake_open,
+    .close = pq_fake_close,
+    .connect = pq_fake_connect,
+    .lookup = pq_fake_lookup,
+    .watch = pq_fake_watch,
+    .disconnect = pq_fake_disconnect,
+    .call = pq_fake_call,
+    .call_async = pq_fake_call_async,
+    .cancel = pq_fake_cancel,
+    .get_ashmem = pq_fake_get_ashmem,
+};
+
+gboolean
+pq_fake_configure(PQContext* ctx,
+                  guint latency_us,
+                  guint fail_every,
+                  guint die_after)
+{
+    PQFake* fake;
+
+    if (!ctx || ctx->transport != &pq_fake_transport)
+        return FALSE;
+
+    fake = ctx->transport_data;
+    fake->latency_us = latency_us;
+    fake->fail_every = fail_every;
+    fake->die_after = die_after;
+    fake->calls = 0;
+    return TRUE;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Per-function call accounting. Every transport records each call here
+ * with relaxed atomics, so recording never takes a lock and the numbers
+ * can be read from any thread while calls are running.
+ */
+
+#include "pq.h"
+#include "pq-transport.h"
+#include <string.h>
+#include <time.h>
+
+static PQFunctionStats pq_stats[PQ_FUNCTION_MAX];
+
+static const gchar pq_stats_xml[] =
+    "<node>"
+    "  <interface name='io.FuriOS.PQ.Stats'>"
+    "    <method name='GetStats'>"
+    "      <arg type='a{s(tttttat)}' name='stats' direction='out'/>"
+    "    </method>"
+    "    <method name='Reset'/>"
+    "  </interface>"
+    "</node>";
+
+gint64
+pq_stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec * G_GINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static guint
+pq_stats_bucket(guint64 elapsed_ns)
+{
+    guint bucket;
+
+    if (elapsed_ns < 2)
+        return 0;
+
+    bucket = 63 - __builtin_clzll(elapsed_ns);
+    return MIN(bucket, PQ_STATS_BUCKETS - 1);
+}
+
+void
+pq_stats_record(int func,
+                PQStatsOutcome outcome,
+                gint64 elapsed_ns)
+{
+    PQFunctionStats *stats;
+    guint64 elapsed = elapsed_ns > 0 ? (guint64)elapsed_ns : 0;
+    guint64 max;
+
+    if (func <= 0 || func >= PQ_FUNCTION_MAX)
+        return;
+
+    stats = &pq_stats[func];
+    __atomic_fetch_add(&stats->calls, 1, __ATOMIC_RELAXED);
+    if (outcome == PQ_STATS_FAILED)
+        __atomic_fetch_add(&stats->failures, 1, __ATOMIC_RELAXED);
+    else if (outcome == PQ_STATS_HAL_ERROR)
+        __atomic_fetch_add(&stats->hal_errors, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->total_ns, elapsed, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->histogram[pq_stats_bucket(elapsed)], 1, __ATOMIC_RELAXED);
+
+    max = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    while (elapsed > max &&
+           !__atomic_compare_exchange_n(&stats->max_ns, &max, elapsed, TRUE,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void
+pq_stats_get(const int func,
+             PQFunctionStats *stats)
+{
+    const PQFunctionStats *src;
+
+    memset(stats, 0, sizeof(*stats));
+    if (func <= 0 || func >= PQ_FUNCTION_MAX)
+        return;
+
+    src = &pq_stats[func];
+    stats->calls = __atomic_load_n(&src->calls, __ATOMIC_RELAXED);
+    stats->failures = __atomic_load_n(&src->failures, __ATOMIC_RELAXED);
+    stats->hal_errors = __atomic_load_n(&src->hal_errors, __ATOMIC_RELAXED);
+    stats->total_ns = __atomic_load_n(&src->total_ns, __ATOMIC_RELAXED);
+    stats->max_ns = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < PQ_STATS_BUCKETS; i++)
+        stats->histogram[i] = __atomic_load_n(&src->histogram[i], __ATOMIC_RELAXED);
+}
+
+void
+pq_stats_reset(void)
+{
+    for (int func = 0; func < PQ_FUNCTION_MAX; func++) {
+        PQFunctionStats *stats = &pq_stats[func];
+
+        __atomic_store_n(&stats->calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->failures, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->hal_errors, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->total_ns, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stats->max_ns, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < PQ_STATS_BUCKETS; i++)
+            __atomic_store_n(&stats->histogram[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+static GVariant *
+pq_stats_to_variant(void)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{s(tttttat)}"));
+    for (int func = 1; func < PQ_FUNCTION_MAX; func++) {
+        PQFunctionStats stats;
+        GVariantBuilder histogram;
+
+        pq_stats_get(func, &stats);
+        /* Only functions that were called, keeps the reply small */
+        if (!stats.calls || !pq_function_name(func))
+            continue;
+
+        g_variant_builder_init(&histogram, G_VARIANT_TYPE("at"));
+        for (int i = 0; i < PQ_STATS_BUCKETS; i++)
+            g_variant_builder_add(&histogram, "t", stats.histogram[i]);
+
+        g_variant_builder_add(&builder, "{s(tttttat)}", pq_function_name(func),
+                              stats.calls, stats.failures, stats.hal_errors,
+                              stats.total_ns, stats.max_ns, &histogram);
+    }
+
+    return g_variant_new("(a{s(tttttat)})", &builder);
+}
+
+static void
+pq_stats_method_call(GDBusConnection* connection,
+                     const gchar* sender,
+                     const gchar* object_path,
+                     const gchar* interface_name,
+                     const gchar* method_name,
+                     GVariant* parameters,
+                     GDBusMethodInvocation* invocation,
+                     gpointer user_data)
+{
+    if (g_strcmp0(method_name, "GetStats") == 0) {
+        g_dbus_method_invocation_return_value(invocation, pq_stats_to_variant());
+    } else if (g_strcmp0(method_name, "Reset") == 0) {
+        pq_stats_reset();
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                              "Unknown method %s", method_name);
+    }
+}
+
+static const
+GDBusInterfaceVTable pq_stats_vtable = {
+    pq_stats_method_call,
+    NULL,
+    NULL
+};
+
+guint
+pq_stats_export(GDBusConnection *connection,
+                const gchar *object_path,
+                GError **error)
+{
+    GDBusNodeInfo *info;
+    guint id;
+
+    info = g_dbus_node_info_new_for_xml(pq_stats_xml, error);
+    if (!info)
+        return 0;
+
+    id = g_dbus_connection_register_object(connection, object_path,
+                                           info->interfaces[0], &pq_stats_vtable,
+                                           NULL, NULL, error);
+    g_dbus_node_info_unref(info);
+    return id;
+}
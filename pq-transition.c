@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Client-side fades for PQ strengths. All running fades of a context
+ * share one timeout that only exists while something is fading. Each
+ * tick computes the eased value, and only an integer change is sent,
+ * one write per setting in flight at a time so a slow HAL never builds
+ * up a backlog.
+ */
+
+#include "pq.h"
+#include "pq-transport.h"
+#include <math.h>
+
+/* Fastest tick, one display frame */
+#define PQ_TRANSITION_MIN_TICK_MS 16
+/* Slowest tick, keeps long ramps responsive to being retargeted */
+#define PQ_TRANSITION_MAX_TICK_MS 1000
+/* Intermediate values are applied by the HAL without its own fade */
+#define PQ_TRANSITION_STEP 0
+
+typedef struct {
+    PQContext* ctx;
+    int setting;
+    gboolean active;
+    gboolean writing;
+    int from;
+    int to;
+    int current;
+    gint64 start_us;
+    gint64 duration_us;
+    PQEasing easing;
+    GSettings *settings;
+} PQTransition;
+
+typedef struct {
+    PQTransition ramps[PQ_SETTING_MAX];
+    guint source_id;
+    guint tick_ms;
+} PQTransitions;
+
+static gboolean pq_transition_tick(gpointer user_data);
+
+static gboolean
+pq_transition_supported(const int setting)
+{
+    switch (setting) {
+        case PQ_SETTING_BLUE_LIGHT_STRENGTH:
+        case PQ_SETTING_CHAMELEON_STRENGTH:
+        case PQ_SETTING_GAMMA_INDEX:
+        case PQ_SETTING_GLOBAL_PQ_STRENGTH:
+            return TRUE;
+        default:
+            return FALSE;
+    }
+}
+
+static double
+pq_ease(PQEasing easing,
+        double t)
+{
+    switch (easing) {
+        case PQ_EASE_IN:
+            return t * t;
+        case PQ_EASE_OUT:
+            return 1.0 - (1.0 - t) * (1.0 - t);
+        case PQ_EASE_IN_OUT:
+            return t * t * (3.0 - 2.0 * t);
+        default:
+            return t;
+    }
+}
+
+static PQTransitions *
+pq_transitions_get(PQContext* ctx)
+{
+    if (!ctx->transitions) {
+        PQTransitions *transitions = g_new0(PQTransitions, 1);
+
+        for (int i = 0; i < PQ_SETTING_MAX; i++) {
+            transitions->ramps[i].ctx = ctx;
+            transitions->ramps[i].setting = i;
+        }
+        ctx->transitions = transitions;
+    }
+
+    return ctx->transitions;
+}
+
+static void
+pq_transition_stop(PQTransition *ramp)
+{
+    ramp->active = FALSE;
+    g_clear_object(&ramp->settings);
+}
+
+/*
+ * Tick often enough to catch every integer step of the fastest ramp,
+ * but no faster than a frame.
+ */
+static void
+pq_transition_schedule(PQContext* ctx)
+{
+    PQTransitions *transitions = ctx->transitions;
+    guint tick_ms = 0;
+
+    for (int i = 0; i < PQ_SETTING_MAX; i++) {
+        PQTransition *ramp = &transitions->ramps[i];
+        gint64 per_step_ms;
+
+        if (!ramp->active)
+            continue;
+
+        per_step_ms = ramp->duration_us / 1000 / MAX(ABS(ramp->to - ramp->from), 1);
+        per_step_ms = CLAMP(per_step_ms / 2, PQ_TRANSITION_MIN_TICK_MS, PQ_TRANSITION_MAX_TICK_MS);
+        tick_ms = tick_ms ? MIN(tick_ms, (guint)per_step_ms) : (guint)per_step_ms;
+    }
+
+    if (tick_ms == transitions->tick_ms && (transitions->source_id || !tick_ms))
+        return;
+
+    if (transitions->source_id) {
+        g_source_remove(transitions->source_id);
+        transitions->source_id = 0;
+    }
+
+    transitions->tick_ms = tick_ms;
+    /* Nothing is fading, stay idle */
+    if (tick_ms)
+        transitions->source_id = g_timeout_add(tick_ms, pq_transition_tick, ctx);
+}
+
+static void
+pq_transition_written(GObject *source,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+    PQTransition *ramp = user_data;
+    GError *error = NULL;
+    int ret = pq_set_setting_finish(result, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* The context is going away */
+        g_error_free(error);
+        return;
+    }
+
+    if (error) {
+        g_debug("Transition step for %s failed: %s", pq_setting_key(ramp->setting), error->message);
+        g_error_free(error);
+    } else if (ret != 0) {
+        g_debug("Transition step for %s failed with %d", pq_setting_key(ramp->setting), ret);
+    }
+
+    ramp->writing = FALSE;
+}
+
+static gboolean
+pq_transition_step(PQTransition *ramp,
+                   gint64 now)
+{
+    double t = (double)(now - ramp->start_us) / ramp->duration_us;
+    gboolean done = t >= 1.0;
+    int value;
+
+    if (done)
+        value = ramp->to;
+    else
+        value = (int)lround(ramp->from + (ramp->to - ramp->from) * pq_ease(ramp->easing, CLAMP(t, 0.0, 1.0)));
+
+    /* The last write hasn't been answered yet, try again next tick */
+    if (ramp->writing && !done)
+        return TRUE;
+
+    if (value != ramp->current || done) {
+        ramp->current = value;
+        ramp->writing = TRUE;
+        /* Only the final value is worth persisting */
+        pq_queue_setting(ramp->ctx, ramp->setting, value, PQ_TRANSITION_STEP,
+                         done ? ramp->settings : NULL, NULL, pq_transition_written, ramp);
+    }
+
+    if (done)
+        pq_transition_stop(ramp);
+
+    return !done;
+}
+
+static gboolean
+pq_transition_tick(gpointer user_data)
+{
+    PQContext* ctx = user_data;
+    PQTransitions *transitions = ctx->transitions;
+    gint64 now = g_get_monotonic_time();
+    gboolean finished = FALSE;
+
+    for (int i = 0; i < PQ_SETTING_MAX; i++) {
+        PQTransition *ramp = &transitions->ramps[i];
+
+        if (ramp->active && !pq_transition_step(ramp, now))
+            finished = TRUE;
+    }
+
+    if (finished) {
+        /* Ramps that are left may need a different rate */
+        transitions->source_id = 0;
+        transitions->tick_ms = 0;
+        pq_transition_schedule(ctx);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+pq_transition_current(PQContext* ctx,
+                      PQTransition *ramp,
+                      int *value)
+{
+    if (ramp->active) {
+        *value = ramp->current;
+        return TRUE;
+    }
+    if (ctx->desired_valid[ramp->setting]) {
+        *value = ctx->desired[ramp->setting];
+        return TRUE;
+    }
+    return pq_get_setting(ctx, ramp->setting, value) == 0;
+}
+
+void
+pq_transition_start(PQContext* ctx,
+                    const int setting,
+                    const int target,
+                    const guint duration_ms,
+                    const PQEasing easing,
+                    GSettings *settings)
+{
+    PQTransition *ramp;
+    int from;
+
+    if (!ctx || !pq_setting_key(setting))
+        return;
+
+    ramp = &pq_transitions_get(ctx)->ramps[setting];
+
+    /* Nothing to interpolate from, or not a strength: jump */
+    if (!duration_ms || !pq_transition_supported(setting) ||
+        !pq_transition_current(ctx, ramp, &from) || from == target) {
+        pq_set_setting_async(ctx, setting, target, PQ_TRANSITION_STEP, settings, NULL, NULL, NULL);
+        return;
+    }
+
+    g_clear_object(&ramp->settings);
+    ramp->settings = settings ? g_object_ref(settings) : NULL;
+    ramp->from = from;
+    ramp->current = from;
+    ramp->to = target;
+    ramp->start_us = g_get_monotonic_time();
+    ramp->duration_us = (gint64)duration_ms * 1000;
+    ramp->easing = easing;
+    ramp->active = TRUE;
+
+    pq_transition_schedule(ctx);
+}
+
+void
+pq_transition_cancel(PQContext* ctx,
+                     const int setting)
+{
+    PQTransitions *transitions;
+
+    if (!ctx || !ctx->transitions || !pq_setting_key(setting))
+        return;
+
+    transitions = ctx->transitions;
+    if (!transitions->ramps[setting].active)
+        return;
+
+    pq_transition_stop(&transitions->ramps[setting]);
+    pq_transition_schedule(ctx);
+}
+
+gboolean
+pq_transition_active(PQContext* ctx,
+                     const int setting)
+{
+    PQTransitions *transitions;
+
+    if (!ctx || !ctx->transitions || !pq_setting_key(setting))
+        return FALSE;
+
+    transitions = ctx->transitions;
+    return transitions->ramps[setting].active;
+}
+
+void
+pq_transitions_free(PQContext* ctx)
+{
+    PQTransitions *transitions = ctx->transitions;
+
+    if (!transitions)
+        return;
+
+    if (transitions->source_id)
+        g_source_remove(transitions->source_id);
+    for (int i = 0; i < PQ_SETTING_MAX; i++)
+        g_clear_object(&transitions->ramps[i].settings);
+
+    g_free(transitions);
+    ctx->transitions = NULL;
+}
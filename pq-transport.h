@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef PQ_TRANSPORT_H
+#define PQ_TRANSPORT_H
+
+/* libpq internal, not installed */
+
+#include "pq.h"
+
+typedef void (*PQTransportReplyFunc)(PQContext* ctx,
+                                     int retval,
+                                     gint32 value,
+                                     gpointer user_data);
+
+struct _PQTransport {
+    const char *name;
+
+    /* Allocate backend state, FALSE if the backend can't be used at all */
+    gboolean (*open)(PQContext* ctx);
+    /* Release everything open() and the connection set up */
+    void (*close)(PQContext* ctx);
+
+    /* Connect right away, TRUE if the service is there */
+    gboolean (*connect)(PQContext* ctx);
+    /* Connect in the background, the result goes to pq_transport_found() */
+    void (*lookup)(PQContext* ctx);
+    /* Report service registrations through pq_transport_registered() */
+    void (*watch)(PQContext* ctx, gboolean watch);
+    /* Drop the connection to a service that died */
+    void (*disconnect)(PQContext* ctx);
+
+    /* Blocking call, returns 0 or an error code and stores the reply value in out */
+    int (*call)(PQContext* ctx, int func, const PQArg* args, gint32 *out);
+    /*
+     * Queued call, reply runs from the main loop. destroy is called on
+     * user_data once the call is done or cancelled. Returns 0, without
+     * calling destroy, if the call couldn't be queued.
+     */
+    gulong (*call_async)(PQContext* ctx, int func, const PQArg* args,
+                         PQTransportReplyFunc reply, gpointer user_data,
+                         GDestroyNotify destroy);
+    /* Cancel a queued call, reply won't run */
+    void (*cancel)(PQContext* ctx, gulong id);
+    /*
+     * Fetch the HAL's shared memory region. Returns 0 with a descriptor
+     * the caller owns in fd, or an error code.
+     */
+    int (*get_ashmem)(PQContext* ctx, int *fd, guint64 *size);
+};
+
+/* Transport events, handled by the context */
+void pq_transport_found(PQContext* ctx, gboolean connected);
+void pq_transport_registered(PQContext* ctx);
+void pq_transport_died(PQContext* ctx);
+
+extern const PQTransport pq_fake_transport;
+
+/* pq_set_setting_async() without cancelling a transition of setting */
+void pq_queue_setting(PQContext* ctx, const int setting, const int value, const int step,
+                      GSettings *settings, GCancellable *cancellable,
+                      GAsyncReadyCallback callback, gpointer user_data);
+
+/* Release the transition state of a context, see pq-transition.c */
+void pq_transitions_free(PQContext* ctx);
+
+/* Call accounting, see pq-stats.c */
+typedef enum {
+    PQ_STATS_OK,
+    /* The transaction itself failed */
+    PQ_STATS_FAILED,
+    /* The HAL answered with a non-zero retval */
+    PQ_STATS_HAL_ERROR
+} PQStatsOutcome;
+
+gint64 pq_stats_now(void);
+void pq_stats_record(int func, PQStatsOutcome outcome, gint64 elapsed_ns);
+
+#endif // PQ_TRANSPORT_H
@@ -5,195 +5,296 @@
  */
 
 #include "pq.h"
+#include "pq-transport.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
 #include <gio/gio.h>
 
-int
-set_color_region_hidl(GBinderClient* client,
-                      const int split_en,
-                      const int start_x,
-                      const int end_x,
-                      const int start_y,
-                      const int end_y)
+/* Writes made from the main loop are committed together after this delay */
+#define PQ_SETTINGS_FLUSH_DELAY_MS 500
+
+#define PQ_SERVICE_NAME "vendor.mediatek.hardware.pq@2.0::IPictureQuality/default"
+#define PQ_INTERFACE_NAME "vendor.mediatek.hardware.pq@2.0::IPictureQuality"
+
+/* Retry delays while waiting for a restarted HAL */
+#define PQ_RECONNECT_MIN_MS 250
+#define PQ_RECONNECT_MAX_MS 10000
+
+static gboolean
+pq_settings_flush_cb(gpointer data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    GSettings *settings = data;
 
-    // setColorRegion
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, split_en);
-    gbinder_writer_append_int32(&writer, start_x);
-    gbinder_writer_append_int32(&writer, end_x);
-    gbinder_writer_append_int32(&writer, start_y);
-    gbinder_writer_append_int32(&writer, end_y);
-    reply = gbinder_client_transact_sync_reply(client, SET_COLOR_REGION, req, &status);
+    g_object_set_data(G_OBJECT(settings), "pq-flush-id", NULL);
+    g_settings_apply(settings);
+    g_settings_sync();
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setColorRegion failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setColorRegion, transaction failed with status %d", status);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pq_settings_write(GSettings *settings,
+                  const char *key,
+                  const int value)
+{
+    guint id;
+
+    if (!settings)
+        return;
+
+    /* Outside of a main loop nothing would run the timer, write through */
+    if (g_main_depth() == 0) {
+        g_settings_set_int(settings, key, value);
+        /* A delayed object only stages the write, commit it with anything staged before */
+        if (g_object_get_data(G_OBJECT(settings), "pq-delayed"))
+            g_settings_apply(settings);
+        g_settings_sync();
+        return;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    if (!g_object_get_data(G_OBJECT(settings), "pq-delayed")) {
+        g_settings_delay(settings);
+        g_object_set_data(G_OBJECT(settings), "pq-delayed", GINT_TO_POINTER(TRUE));
+    }
 
-    return retval;
+    g_settings_set_int(settings, key, value);
+
+    if (!g_object_get_data(G_OBJECT(settings), "pq-flush-id")) {
+        id = g_timeout_add_full(G_PRIORITY_LOW, PQ_SETTINGS_FLUSH_DELAY_MS,
+                                pq_settings_flush_cb, g_object_ref(settings),
+                                g_object_unref);
+        g_object_set_data(G_OBJECT(settings), "pq-flush-id", GUINT_TO_POINTER(id));
+    }
 }
 
-int
-set_pq_mode_hidl(GBinderClient* client,
-                 const int mode,
-                 const int step,
-                 GSettings *settings)
+void
+pq_settings_flush(GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    guint id;
 
-    // setPQMode
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, mode);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_PQ_MODE, req, &status);
+    if (!settings)
+        return;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setPQMode failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setPQMode, transaction failed with status %d", status);
+    id = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(settings), "pq-flush-id"));
+    if (id) {
+        g_object_set_data(G_OBJECT(settings), "pq-flush-id", NULL);
+        g_source_remove(id);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    if (settings) {
-        g_settings_set_int(settings, "pq-mode", mode);
+    if (g_settings_get_has_unapplied(settings)) {
+        g_settings_apply(settings);
         g_settings_sync();
     }
+}
 
-    return retval;
+typedef struct {
+    const char *name;
+    /* One character per value: i int32, b bool, d double, m 4x4 float matrix, h memory handle */
+    const char *args;
+    const char *reply;
+} PQFunctionInfo;
+
+static const PQFunctionInfo pq_functions[PQ_FUNCTION_MAX] = {
+    [SET_COLOR_REGION] = { "setColorRegion", "iiiii", "" },
+    [SET_PQ_MODE] = { "setPQMode", "ii", "" },
+    [SET_TDSHP_FLAG] = { "setTDSHPFlag", "i", "" },
+    [GET_TDSHP_FLAG] = { "getTDSHPFlag", "", "i" },
+    [SET_PQ_INDEX] = { "setPQIndex", "iiiii", "" },
+    [SET_DISP_SCENARIO] = { "setDISPScenario", "ii", "" },
+    [SET_FEATURE_SWITCH] = { "setFeatureSwitch", "ii", "" },
+    [GET_FEATURE_SWITCH] = { "getFeatureSwitch", "i", "i" },
+    [ENABLE_BLUE_LIGHT] = { "enableBlueLight", "bi", "" },
+    [GET_BLUE_LIGHT_ENABLED] = { "getBlueLightEnabled", "", "b" },
+    [SET_BLUE_LIGHT_STRENGTH] = { "setBlueLightStrength", "ii", "" },
+    [GET_BLUE_LIGHT_STRENGTH] = { "getBlueLightStrength", "", "i" },
+    [ENABLE_CHAMELEON] = { "enableChameleon", "bi", "" },
+    [GET_CHAMELEON_ENABLED] = { "getChameleonEnabled", "", "b" },
+    [SET_CHAMELEON_STRENGTH] = { "setChameleonStrength", "ii", "" },
+    [GET_CHAMELEON_STRENGTH] = { "getChameleonStrength", "", "i" },
+    [SET_TUNING_FIELD] = { "setTuningField", "iii", "" },
+    [GET_TUNING_FIELD] = { "getTuningField", "ii", "i" },
+    /* The region itself is only picked up by pq_ashmem_map() */
+    [GET_ASHMEM] = { "getAshmem", "", "h" },
+    [SET_AMBIENT_LIGHT_CT] = { "setAmbientLightCT", "ddd", "" },
+    [SET_AMBIENT_LIGHT_RGBW] = { "setAmbientLightRGBW", "iiii", "" },
+    [SET_GAMMA_INDEX] = { "setGammaIndex", "ii", "" },
+    [GET_GAMMA_INDEX] = { "getGammaIndex", "", "i" },
+    [SET_EXTERNAL_PANEL_NITS] = { "setExternalPanelNits", "i", "" },
+    [GET_EXTERNAL_PANEL_NITS] = { "getExternalPanelNits", "", "i" },
+    [SET_COLOR_TRANSFORM] = { "setColorTransform", "mii", "" },
+    [SET_RGB_GAIN] = { "setRGBGain", "iiii", "" },
+    [SET_GLOBAL_PQ_SWITCH] = { "setGlobalPQSwitch", "i", "" },
+    [GET_GLOBAL_PQ_SWITCH] = { "getGlobalPQSwitch", "", "i" },
+    [SET_GLOBAL_PQ_STRENGTH] = { "setGlobalPQStrength", "i", "" },
+    [GET_GLOBAL_PQ_STRENGTH] = { "getGlobalPQStrength", "", "i" },
+    [SET_GLOBAL_PQ_STABLE_STATUS] = { "setGlobalPQStableStatus", "i", "" },
+    [GET_GLOBAL_PQ_STABLE_STATUS] = { "getGlobalPQStableStatus", "", "i" },
+};
+
+typedef struct {
+    const char *key;
+    int func;
+    int get_func;
+    int feature;
+} PQSettingInfo;
+
+static const PQSettingInfo pq_settings[PQ_SETTING_MAX] = {
+    [PQ_SETTING_PQ_MODE] = { "pq-mode", SET_PQ_MODE, -1, -1 },
+    [PQ_SETTING_BLUE_LIGHT] = { "blue-light", ENABLE_BLUE_LIGHT, GET_BLUE_LIGHT_ENABLED, -1 },
+    [PQ_SETTING_BLUE_LIGHT_STRENGTH] = { "blue-light-strength", SET_BLUE_LIGHT_STRENGTH, GET_BLUE_LIGHT_STRENGTH, -1 },
+    [PQ_SETTING_CHAMELEON] = { "chameleon", ENABLE_CHAMELEON, GET_CHAMELEON_ENABLED, -1 },
+    [PQ_SETTING_CHAMELEON_STRENGTH] = { "chameleon-strength", SET_CHAMELEON_STRENGTH, GET_CHAMELEON_STRENGTH, -1 },
+    [PQ_SETTING_GAMMA_INDEX] = { "gamma-index", SET_GAMMA_INDEX, GET_GAMMA_INDEX, -1 },
+    [PQ_SETTING_DISPLAY_COLOR] = { "display-color", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DISPLAY_COLOR },
+    [PQ_SETTING_CONTENT_COLOR] = { "content-color", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, CONTENT_COLOR },
+    [PQ_SETTING_CONTENT_COLOR_VIDEO] = { "content-color-video", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, CONTENT_COLOR_VIDEO },
+    [PQ_SETTING_SHARPNESS] = { "sharpness", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, SHARPNESS },
+    [PQ_SETTING_DYNAMIC_CONTRAST] = { "dynamic-contrast", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DYNAMIC_CONTRAST },
+    [PQ_SETTING_DYNAMIC_SHARPNESS] = { "dynamic-sharpness", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DYNAMIC_SHARPNESS },
+    [PQ_SETTING_DISPLAY_CCORR] = { "display-ccorr", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DISPLAY_CCORR },
+    [PQ_SETTING_DISPLAY_GAMMA] = { "display-gamma", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DISPLAY_GAMMA },
+    [PQ_SETTING_DISPLAY_OVER_DRIVE] = { "display-over-drive", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, DISPLAY_OVER_DRIVE },
+    [PQ_SETTING_ISO_ADAPTIVE_SHARPNESS] = { "iso-adaptive-sharpness", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, ISO_ADAPTIVE_SHARPNESS },
+    [PQ_SETTING_ULTRA_RESOLUTION] = { "ultra-resolution", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, ULTRA_RESOLUTION },
+    [PQ_SETTING_VIDEO_HDR] = { "video-hdr", SET_FEATURE_SWITCH, GET_FEATURE_SWITCH, VIDEO_HDR },
+    [PQ_SETTING_GLOBAL_PQ_SWITCH] = { "global-pq-switch", SET_GLOBAL_PQ_SWITCH, GET_GLOBAL_PQ_SWITCH, -1 },
+    [PQ_SETTING_GLOBAL_PQ_STRENGTH] = { "global-pq-strength", SET_GLOBAL_PQ_STRENGTH, GET_GLOBAL_PQ_STRENGTH, -1 },
+};
+
+static const gfloat pq_identity_matrix[PQ_COLOR_MATRIX_SIZE] = {
+    1, 0, 0, 0,
+    0, 1, 0, 0,
+    0, 0, 1, 0,
+    0, 0, 0, 1,
+};
+
+/*
+ * vec<vec<float>> is an array of hidl_vec rows, each pointing at its
+ * floats. The buffers live as long as the request does.
+ */
+static void
+pq_write_matrix(GBinderWriter* writer,
+                const gfloat *matrix)
+{
+    GBinderHidlVec* outer = gbinder_writer_new0(writer, GBinderHidlVec);
+    GBinderHidlVec* rows = gbinder_writer_malloc0(writer, 4 * sizeof(GBinderHidlVec));
+    gfloat *values = gbinder_writer_memdup(writer, matrix ? matrix : pq_identity_matrix,
+                                           PQ_COLOR_MATRIX_SIZE * sizeof(gfloat));
+    GBinderParent parent;
+    guint index;
+
+    for (int i = 0; i < 4; i++) {
+        rows[i].data.ptr = values + i * 4;
+        rows[i].count = 4;
+        rows[i].owns_buffer = TRUE;
+    }
+    outer->data.ptr = rows;
+    outer->count = 4;
+    outer->owns_buffer = TRUE;
+
+    parent.index = gbinder_writer_append_buffer_object(writer, outer, sizeof(*outer));
+    parent.offset = GBINDER_HIDL_VEC_BUFFER_OFFSET;
+    index = gbinder_writer_append_buffer_object_with_parent(writer, rows, 4 * sizeof(GBinderHidlVec), &parent);
+
+    parent.index = index;
+    for (int i = 0; i < 4; i++) {
+        parent.offset = i * sizeof(GBinderHidlVec) + GBINDER_HIDL_VEC_BUFFER_OFFSET;
+        gbinder_writer_append_buffer_object_with_parent(writer, values + i * 4, 4 * sizeof(gfloat), &parent);
+    }
 }
 
-int
-set_tdshp_flag(GBinderClient* client,
-               const int tdshp_flag)
+static GBinderLocalRequest *
+pq_new_request(GBinderClient* client,
+               const int func,
+               const PQArg* args)
 {
-    gint status = 0, retval = 0;
     GBinderLocalRequest* req = gbinder_client_new_request(client);
+    const char *layout = pq_functions[func].args;
     GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
 
-    // setTDSHPFlag
     gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, tdshp_flag);
-    reply = gbinder_client_transact_sync_reply(client, SET_TDSHP_FLAG, req, &status);
-
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setTDSHPFlag failed, PQ returned the value %d", retval);
+    for (int i = 0; layout[i]; i++) {
+        switch (layout[i]) {
+            case 'b':
+                gbinder_writer_append_bool(&writer, args[i].i);
+                break;
+            case 'd':
+                gbinder_writer_append_double(&writer, args[i].d);
+                break;
+            case 'm':
+                pq_write_matrix(&writer, args[i].m);
+                break;
+            default:
+                gbinder_writer_append_int32(&writer, args[i].i);
+                break;
         }
-    } else {
-        retval = status;
-        g_debug("Failed to call setTDSHPFlag, transaction failed with status %d", status);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    return retval;
+    return req;
 }
 
-int
-get_tdshp_flag(GBinderClient* client)
+static int
+pq_read_reply(const int func,
+              GBinderRemoteReply* reply,
+              gint status,
+              gint32 *out,
+              const gint64 started)
 {
-    gint status = 0, retval = 0, tdshp_flag;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
+    const PQFunctionInfo* info = &pq_functions[func];
+    gint retval = 0;
     GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // getTDSHPFlag
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, tdshp_flag);
-    reply = gbinder_client_transact_sync_reply(client, GET_TDSHP_FLAG, req, &status);
+    PQStatsOutcome outcome = PQ_STATS_OK;
 
     gbinder_remote_reply_init_reader(reply, &reader);
     gbinder_reader_read_int32(&reader, &status);
     if (status == 0) {
         gbinder_reader_read_int32(&reader, &retval);
         if (retval != 0) {
-            g_debug("getTDSHPFlag failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &tdshp_flag);
-            retval = tdshp_flag;
+            outcome = PQ_STATS_HAL_ERROR;
+            g_debug("%s failed, PQ returned the value %d", info->name, retval);
+        } else if (info->reply[0] == 'b') {
+            gboolean value = FALSE;
+
+            gbinder_reader_read_bool(&reader, &value);
+            *out = value ? 1 : 0;
+        } else if (info->reply[0] == 'i') {
+            gbinder_reader_read_int32(&reader, out);
         }
     } else {
         retval = status;
-        g_debug("Failed to call getTDSHPFlag, transaction failed with status %d", status);
+        outcome = PQ_STATS_FAILED;
+        g_debug("Failed to call %s, transaction failed with status %d", info->name, status);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
+    pq_stats_record(func, outcome, pq_stats_now() - started);
     return retval;
 }
 
-int
-set_pq_index_hidl(GBinderClient* client,
-                  const int level,
-                  const int scenario,
-                  const int tuning_mode,
-                  const int index,
-                  const int step)
+/*
+ * Send one call described by pq_functions and wait for the reply.
+ * Returns 0 on success, the PQ or transaction error code otherwise.
+ */
+static int
+pq_transact(GBinderClient* client,
+            const int func,
+            const PQArg* args,
+            gint32 *out)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
+    GBinderLocalRequest* req;
     GBinderRemoteReply* reply;
+    gint32 value = 0;
+    gint status = 0, retval;
+    gint64 started;
 
-    // setPQIndex
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, level);
-    gbinder_writer_append_int32(&writer, scenario);
-    gbinder_writer_append_int32(&writer, tuning_mode);
-    gbinder_writer_append_int32(&writer, index);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_PQ_INDEX, req, &status);
+    if (!client || func <= 0 || func >= PQ_FUNCTION_MAX || !pq_functions[func].name)
+        return -1;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setPQIndex failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setPQIndex, transaction failed with status %d", status);
-    }
+    started = pq_stats_now();
+    req = pq_new_request(client, func, args);
+    reply = gbinder_client_transact_sync_reply(client, func, req, &status);
+    retval = pq_read_reply(func, reply, status, out ? out : &value, started);
 
     gbinder_local_request_unref(req);
     gbinder_remote_reply_unref(reply);
@@ -201,119 +302,127 @@ set_pq_index_hidl(GBinderClient* client,
     return retval;
 }
 
-int
-set_disp_scenario(GBinderClient* client,
-                  const int scenario,
-                  const int step)
+static int
+pq_transact_get(GBinderClient* client,
+                const int func,
+                const PQArg* args)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    gint32 value = 0;
 
-    // setDISPScenario
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, scenario);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_DISP_SCENARIO, req, &status);
+    /* PQ error codes overlap with valid values, report them all as -1 */
+    if (pq_transact(client, func, args, &value) != 0)
+        return -1;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setDISPScenario failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setDISPScenario, transaction failed with status %d", status);
-    }
+    return value;
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+static void
+pq_setting_args(const PQSettingInfo* info,
+                const int value,
+                const int step,
+                PQArg* args)
+{
+    gsize n = 0;
+
+    if (info->feature >= 0)
+        args[n++].i = info->feature;
+    args[n++].i = value;
+    if (n < strlen(pq_functions[info->func].args))
+        args[n++].i = step;
+}
+
+static int
+pq_apply_setting(GBinderClient* client,
+                 const int setting,
+                 const int value,
+                 const int step,
+                 GSettings *settings)
+{
+    const PQSettingInfo* info = &pq_settings[setting];
+    PQArg args[PQ_MAX_ARGS];
+    int retval;
+
+    pq_setting_args(info, value, step, args);
+    retval = pq_transact(client, info->func, args, NULL);
+    pq_settings_write(settings, info->key, value);
 
     return retval;
 }
 
 int
-set_feature_display_color_hidl(GBinderClient* client,
-                               const int mode,
-                               GSettings *settings)
+set_color_region_hidl(GBinderClient* client,
+                      const int split_en,
+                      const int start_x,
+                      const int end_x,
+                      const int start_y,
+                      const int end_y)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQArg args[] = { { .i = split_en }, { .i = start_x }, { .i = end_x }, { .i = start_y }, { .i = end_y } };
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DISPLAY_COLOR);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_transact(client, SET_COLOR_REGION, args, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch display color failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch display color, transaction failed with status %d", status);
-    }
+int
+set_pq_mode_hidl(GBinderClient* client,
+                 const int mode,
+                 const int step,
+                 GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_PQ_MODE, mode, step, settings);
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+int
+set_tdshp_flag(GBinderClient* client,
+               const int tdshp_flag)
+{
+    PQArg args[] = { { .i = tdshp_flag } };
 
-    if (settings) {
-        g_settings_set_int(settings, "display-color", mode);
-        g_settings_sync();
-    }
+    return pq_transact(client, SET_TDSHP_FLAG, args, NULL);
+}
 
-    return retval;
+int
+get_tdshp_flag(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_TDSHP_FLAG, NULL);
 }
 
 int
-set_feature_content_color_hidl(GBinderClient* client,
-                               const int mode,
-                               GSettings *settings)
+set_pq_index_hidl(GBinderClient* client,
+                  const int level,
+                  const int scenario,
+                  const int tuning_mode,
+                  const int index,
+                  const int step)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQArg args[] = { { .i = level }, { .i = scenario }, { .i = tuning_mode }, { .i = index }, { .i = step } };
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, CONTENT_COLOR);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_transact(client, SET_PQ_INDEX, args, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch content color failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch content color, transaction failed with status %d", status);
-    }
+int
+set_disp_scenario(GBinderClient* client,
+                  const int scenario,
+                  const int step)
+{
+    PQArg args[] = { { .i = scenario }, { .i = step } };
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return pq_transact(client, SET_DISP_SCENARIO, args, NULL);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "content-color", mode);
-        g_settings_sync();
-    }
+int
+set_feature_display_color_hidl(GBinderClient* client,
+                               const int mode,
+                               GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_DISPLAY_COLOR, mode, 0, settings);
+}
 
-    return retval;
+int
+set_feature_content_color_hidl(GBinderClient* client,
+                               const int mode,
+                               GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_CONTENT_COLOR, mode, 0, settings);
 }
 
 int
@@ -321,1345 +430,1516 @@ set_feature_content_color_video_hidl(GBinderClient* client,
                                      const int mode,
                                      GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    return pq_apply_setting(client, PQ_SETTING_CONTENT_COLOR_VIDEO, mode, 0, settings);
+}
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, CONTENT_COLOR_VIDEO);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+int
+set_feature_sharpness_hidl(GBinderClient* client,
+                           const int mode,
+                           GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_SHARPNESS, mode, 0, settings);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch content color video failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch content color video, transaction failed with status %d", status);
-    }
-
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    if (settings) {
-        g_settings_set_int(settings, "content-color-video", mode);
-        g_settings_sync();
-    }
-
-    return retval;
+int
+set_feature_dynamic_contrast_hidl(GBinderClient* client,
+                                  const int mode,
+                                  GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_DYNAMIC_CONTRAST, mode, 0, settings);
 }
 
 int
-set_feature_sharpness_hidl(GBinderClient* client,
-                           const int mode,
-                           GSettings *settings)
+set_feature_dynamic_sharpness_hidl(GBinderClient* client,
+                                   const int mode,
+                                   GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, SHARPNESS);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_apply_setting(client, PQ_SETTING_DYNAMIC_SHARPNESS, mode, 0, settings);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch sharpness failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch sharpness, transaction failed with status %d", status);
-    }
+int
+set_feature_display_ccorr_hidl(GBinderClient* client,
+                               const int mode,
+                               GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_DISPLAY_CCORR, mode, 0, settings);
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+int
+set_feature_display_gamma_hidl(GBinderClient* client,
+                               const int mode,
+                               GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_DISPLAY_GAMMA, mode, 0, settings);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "sharpness", mode);
-        g_settings_sync();
-    }
+int
+set_feature_display_over_drive_hidl(GBinderClient* client,
+                                    const int mode,
+                                    GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_DISPLAY_OVER_DRIVE, mode, 0, settings);
+}
 
-    return retval;
+int
+set_feature_iso_adaptive_sharpness_hidl(GBinderClient* client,
+                                        const int mode,
+                                        GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_ISO_ADAPTIVE_SHARPNESS, mode, 0, settings);
 }
 
 int
-set_feature_dynamic_contrast_hidl(GBinderClient* client,
+set_feature_ultra_resolution_hidl(GBinderClient* client,
                                   const int mode,
                                   GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    return pq_apply_setting(client, PQ_SETTING_ULTRA_RESOLUTION, mode, 0, settings);
+}
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DYNAMIC_CONTRAST);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+int
+set_feature_video_hdr_hidl(GBinderClient* client,
+                           const int mode,
+                           GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_VIDEO_HDR, mode, 0, settings);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch dynamic contrast failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch dynamic contrast, transaction failed with status %d", status);
-    }
+int
+get_feature_switch(GBinderClient* client,
+                   const int feature)
+{
+    PQArg args[] = { { .i = feature } };
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return pq_transact_get(client, GET_FEATURE_SWITCH, args);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "dynamic-contrast", mode);
-        g_settings_sync();
-    }
+int
+enable_blue_light_hidl(GBinderClient* client,
+                       const int enable,
+                       const int step,
+                       GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_BLUE_LIGHT, enable, step, settings);
+}
 
-    return retval;
+int
+get_blue_light_enabled_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_BLUE_LIGHT_ENABLED, NULL);
 }
 
 int
-set_feature_dynamic_sharpness_hidl(GBinderClient* client,
-                                   const int mode,
-                                   GSettings *settings)
+set_blue_light_strength_hidl(GBinderClient* client,
+                             const int strength,
+                             const int step,
+                             GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    return pq_apply_setting(client, PQ_SETTING_BLUE_LIGHT_STRENGTH, strength, step, settings);
+}
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DYNAMIC_SHARPNESS);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+int
+get_blue_light_strength_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_BLUE_LIGHT_STRENGTH, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch dynamic sharpness failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch dynamic sharpness, transaction failed with status %d", status);
-    }
+int
+enable_chameleon_hidl(GBinderClient* client,
+                      const int enable,
+                      const int step,
+                      GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_CHAMELEON, enable, step, settings);
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+int
+get_chameleon_enabled_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_CHAMELEON_ENABLED, NULL);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "dynamic-sharpness", mode);
-        g_settings_sync();
-    }
+int
+set_chameleon_strength_hidl(GBinderClient* client,
+                            const int strength,
+                            const int step,
+                            GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_CHAMELEON_STRENGTH, strength, step, settings);
+}
 
-    return retval;
+int
+get_chameleon_strength_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_CHAMELEON_STRENGTH, NULL);
 }
 
 int
-set_feature_display_ccorr_hidl(GBinderClient* client,
-                               const int mode,
-                               GSettings *settings)
+set_tuning_field_hidl(GBinderClient* client,
+                      const int pq_module,
+                      const int field,
+                      const int value)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQArg args[] = { { .i = pq_module }, { .i = field }, { .i = value } };
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DISPLAY_CCORR);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_transact(client, SET_TUNING_FIELD, args, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch display ccorr failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch display ccorr , transaction failed with status %d", status);
-    }
+int
+get_tuning_field_hidl(GBinderClient* client,
+                      const int pq_module,
+                      const int field)
+{
+    PQArg args[] = { { .i = pq_module }, { .i = field } };
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return pq_transact_get(client, GET_TUNING_FIELD, args);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "display-ccorr", mode);
-        g_settings_sync();
-    }
+int
+set_ambient_light_ct_hidl(GBinderClient* client,
+                          gdouble input_x,
+                          gdouble input_y,
+                          gdouble input_Y)
+{
+    PQArg args[] = { { .d = input_x }, { .d = input_y }, { .d = input_Y } };
 
-    return retval;
+    return pq_transact(client, SET_AMBIENT_LIGHT_CT, args, NULL);
 }
 
 int
-set_feature_display_gamma_hidl(GBinderClient* client,
-                               const int mode,
-                               GSettings *settings)
+set_ambient_light_rgbw_hidl(GBinderClient* client,
+                            const int input_R,
+                            const int input_G,
+                            const int input_B,
+                            const int input_W)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQArg args[] = { { .i = input_R }, { .i = input_G }, { .i = input_B }, { .i = input_W } };
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DISPLAY_GAMMA);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_transact(client, SET_AMBIENT_LIGHT_RGBW, args, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch display gamma failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch display gamma, transaction failed with status %d", status);
-    }
+int
+set_gamma_index_hidl(GBinderClient* client,
+                     const int index,
+                     const int step,
+                     GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_GAMMA_INDEX, index, step, settings);
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+int
+get_gamma_index_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_GAMMA_INDEX, NULL);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "display-gamma", mode);
-        g_settings_sync();
-    }
+int
+set_external_panel_nits_hidl(GBinderClient* client,
+                             const int nits)
+{
+    PQArg args[] = { { .i = nits } };
 
-    return retval;
+    return pq_transact(client, SET_EXTERNAL_PANEL_NITS, args, NULL);
 }
 
 int
-set_feature_display_over_drive_hidl(GBinderClient* client,
-                                    const int mode,
-                                    GSettings *settings)
+get_external_panel_nits_hidl(GBinderClient* client)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, DISPLAY_OVER_DRIVE);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    return pq_transact_get(client, GET_EXTERNAL_PANEL_NITS, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch display over drive failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch display over drive, transaction failed with status %d", status);
-    }
+int
+set_rgb_gain_hidl(GBinderClient* client,
+                  const int r_gain,
+                  const int g_gain,
+                  const int b_gain,
+                  const int step)
+{
+    PQArg args[] = { { .i = r_gain }, { .i = g_gain }, { .i = b_gain }, { .i = step } };
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return pq_transact(client, SET_RGB_GAIN, args, NULL);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "display-over-drive", mode);
-        g_settings_sync();
-    }
+int
+set_global_pq_switch_hidl(GBinderClient* client,
+                          const int mode,
+                          GSettings *settings)
+{
+    return pq_apply_setting(client, PQ_SETTING_GLOBAL_PQ_SWITCH, mode, 0, settings);
+}
 
-    return retval;
+int
+get_global_pq_switch_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_GLOBAL_PQ_SWITCH, NULL);
 }
 
 int
-set_feature_iso_adaptive_sharpness_hidl(GBinderClient* client,
-                                        const int mode,
-                                        GSettings *settings)
+set_global_pq_strength_hidl(GBinderClient* client,
+                            const int strength,
+                            GSettings *settings)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    return pq_apply_setting(client, PQ_SETTING_GLOBAL_PQ_STRENGTH, strength, 0, settings);
+}
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, ISO_ADAPTIVE_SHARPNESS);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+int
+get_global_pq_strength_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_GLOBAL_PQ_STRENGTH, NULL);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch iso adaptive sharpness failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch iso adaptive sharpness, transaction failed with status %d", status);
-    }
+int
+set_global_pq_stable_status_hidl(GBinderClient* client,
+                                 const int stable)
+{
+    PQArg args[] = { { .i = stable } };
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return pq_transact(client, SET_GLOBAL_PQ_STABLE_STATUS, args, NULL);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "iso-adaptive-sharpness", mode);
-        g_settings_sync();
-    }
+int
+get_global_pq_stable_status_hidl(GBinderClient* client)
+{
+    return pq_transact_get(client, GET_GLOBAL_PQ_STABLE_STATUS, NULL);
+}
 
-    return retval;
+/*
+ * Binder transport: talks to the vendor HAL over /dev/hwbinder using the
+ * servicemanager, remote object and client kept in the context.
+ */
+typedef struct {
+    PQContext* ctx;
+    int func;
+    PQTransportReplyFunc reply;
+    gpointer user_data;
+    GDestroyNotify destroy;
+    gint64 started;
+} PQBinderCall;
+
+static void pq_binder_on_died(GBinderRemoteObject* remote, void* user_data);
+
+static gboolean
+pq_binder_open(PQContext* ctx)
+{
+    ctx->sm = gbinder_servicemanager_new("/dev/hwbinder");
+    return ctx->sm != NULL;
 }
 
-int
-set_feature_ultra_resolution_hidl(GBinderClient* client,
-                                  const int mode,
-                                  GSettings *settings)
+static gboolean
+pq_binder_attach(PQContext* ctx,
+                 GBinderRemoteObject* remote)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, ULTRA_RESOLUTION);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+    ctx->client = gbinder_client_new(remote, PQ_INTERFACE_NAME);
+    if (!ctx->client)
+        return FALSE;
+
+    ctx->remote = gbinder_remote_object_ref(remote);
+    ctx->death_id = gbinder_remote_object_add_death_handler(ctx->remote,
+        pq_binder_on_died, ctx);
+    return TRUE;
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch ultra resolution failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch ultra resolution, transaction failed with status %d", status);
-    }
+static gboolean
+pq_binder_connect(PQContext* ctx)
+{
+    /* Autoreleased by the service manager, pq_binder_attach() takes its own reference */
+    GBinderRemoteObject* remote = gbinder_servicemanager_get_service_sync(ctx->sm, PQ_SERVICE_NAME, NULL);
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return remote && pq_binder_attach(ctx, remote);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "ultra-resolution", mode);
-        g_settings_sync();
-    }
+static void
+pq_binder_on_service_found(GBinderServiceManager* sm,
+                           GBinderRemoteObject* remote,
+                           int status,
+                           void* user_data)
+{
+    PQContext* ctx = user_data;
 
-    return retval;
+    ctx->lookup_id = 0;
+    pq_transport_found(ctx, remote && pq_binder_attach(ctx, remote));
 }
 
-int
-set_feature_video_hdr_hidl(GBinderClient* client,
-                           const int mode,
-                           GSettings *settings)
+static void
+pq_binder_lookup(PQContext* ctx)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    ctx->lookup_id = gbinder_servicemanager_get_service(ctx->sm, PQ_SERVICE_NAME,
+                                                        pq_binder_on_service_found, ctx);
+    if (!ctx->lookup_id)
+        pq_transport_found(ctx, FALSE);
+}
 
-    // setFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, VIDEO_HDR);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_FEATURE_SWITCH, req, &status);
+static void
+pq_binder_on_service_registered(GBinderServiceManager* sm,
+                                const char* name,
+                                void* user_data)
+{
+    pq_transport_registered(user_data);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setFeatureSwitch video hdr failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setFeatureSwitch video hdr, transaction failed with status %d", status);
+static void
+pq_binder_watch(PQContext* ctx,
+                gboolean watch)
+{
+    if (watch && !ctx->registration_id) {
+        ctx->registration_id = gbinder_servicemanager_add_registration_handler(ctx->sm,
+            PQ_SERVICE_NAME, pq_binder_on_service_registered, ctx);
+    } else if (!watch && ctx->registration_id) {
+        gbinder_servicemanager_remove_handler(ctx->sm, ctx->registration_id);
+        ctx->registration_id = 0;
     }
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    if (settings) {
-        g_settings_set_int(settings, "video-hdr", mode);
-        g_settings_sync();
+static void
+pq_binder_disconnect(PQContext* ctx)
+{
+    if (ctx->client) {
+        gbinder_client_unref(ctx->client);
+        ctx->client = NULL;
+    }
+    if (ctx->remote) {
+        gbinder_remote_object_remove_handler(ctx->remote, ctx->death_id);
+        gbinder_remote_object_unref(ctx->remote);
+        ctx->remote = NULL;
+        ctx->death_id = 0;
     }
-
-    return retval;
 }
 
-int
-get_feature_switch(GBinderClient* client,
-                   const int feature)
+static void
+pq_binder_close(PQContext* ctx)
 {
-    gint status = 0, retval = 0, value;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    if (!ctx->sm)
+        return;
 
-    // getFeatureSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, feature);
-    reply = gbinder_client_transact_sync_reply(client, GET_FEATURE_SWITCH, req, &status);
+    if (ctx->lookup_id)
+        gbinder_servicemanager_cancel(ctx->sm, ctx->lookup_id);
+    pq_binder_watch(ctx, FALSE);
+    pq_binder_disconnect(ctx);
+    gbinder_servicemanager_unref(ctx->sm);
+    ctx->sm = NULL;
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getFeatureSwitch failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &value);
-            retval = value;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getFeatureSwitch, transaction failed with status %d", status);
-    }
+static int
+pq_binder_call(PQContext* ctx,
+               const int func,
+               const PQArg* args,
+               gint32 *out)
+{
+    return pq_transact(ctx->client, func, args, out);
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+static void
+pq_binder_call_reply(GBinderClient* client,
+                     GBinderRemoteReply* reply,
+                     int status,
+                     void* user_data)
+{
+    PQBinderCall *call = user_data;
+    gint32 value = 0;
+    gint retval = pq_read_reply(call->func, reply, status, &value, call->started);
 
-    return retval;
+    call->reply(call->ctx, retval, value, call->user_data);
 }
 
-int
-enable_blue_light_hidl(GBinderClient* client,
-                       const int enable,
-                       const int step,
-                       GSettings *settings)
+static void
+pq_binder_call_free(gpointer data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQBinderCall *call = data;
 
-    // enableBlueLight
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_bool(&writer, enable);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, ENABLE_BLUE_LIGHT, req, &status);
-
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("enableBlueLight failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call enableBlueLight, transaction failed with status %d", status);
-    }
+    if (call->destroy)
+        call->destroy(call->user_data);
+    g_free(call);
+}
 
+static gulong
+pq_binder_call_async(PQContext* ctx,
+                     const int func,
+                     const PQArg* args,
+                     PQTransportReplyFunc reply,
+                     gpointer user_data,
+                     GDestroyNotify destroy)
+{
+    PQBinderCall *call = g_new0(PQBinderCall, 1);
+    GBinderLocalRequest* req = pq_new_request(ctx->client, func, args);
+    gulong id;
+
+    call->ctx = ctx;
+    call->func = func;
+    call->reply = reply;
+    call->user_data = user_data;
+    call->destroy = destroy;
+    call->started = pq_stats_now();
+
+    id = gbinder_client_transact(ctx->client, func, 0, req,
+                                 pq_binder_call_reply, pq_binder_call_free, call);
     gbinder_local_request_unref(req);
 
-    if (settings) {
-        g_settings_set_int(settings, "blue-light", enable);
-        g_settings_sync();
+    if (!id) {
+        /* Only the caller's data is released, the call was never queued */
+        g_free(call);
     }
+    return id;
+}
 
-    return retval;
+static void
+pq_binder_cancel(PQContext* ctx,
+                 gulong id)
+{
+    gbinder_client_cancel(ctx->client, id);
 }
 
-int
-get_blue_light_enabled_hidl(GBinderClient* client)
+/* android.hidl.memory hidl_memory as laid out in the parcel */
+typedef struct {
+    union {
+        guint64 value;
+        const GBinderFds* fds;
+    } handle;
+    guint8 owns_handle;
+    guint8 pad[7];
+    guint64 size;
+    GBinderHidlString name;
+} PQHidlMemory;
+
+G_STATIC_ASSERT(sizeof(PQHidlMemory) == 40);
+
+static int
+pq_binder_get_ashmem(PQContext* ctx,
+                     int *fd,
+                     guint64 *size)
 {
-    gint status = 0, retval = 0;
-    gboolean is_enabled = FALSE;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
+    GBinderLocalRequest* req = gbinder_client_new_request(ctx->client);
     GBinderRemoteReply* reply;
-
-    // getBlueLightEnabled
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_BLUE_LIGHT_ENABLED, req, &status);
-
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getBlueLightEnabled failed, PQ returned the value %d", retval);
+    GBinderReader reader;
+    const PQHidlMemory* memory = NULL;
+    const GBinderFds* fds = NULL;
+    gint32 value = 0;
+    gint status = 0, retval;
+    gint64 started = pq_stats_now();
+
+    reply = gbinder_client_transact_sync_reply(ctx->client, GET_ASHMEM, req, &status);
+    retval = pq_read_reply(GET_ASHMEM, reply, status, &value, started);
+
+    if (retval == 0) {
+        /* Status and retval were checked above, the memory follows */
+        gbinder_remote_reply_init_reader(reply, &reader);
+        gbinder_reader_read_int32(&reader, &value);
+        gbinder_reader_read_int32(&reader, &value);
+        memory = gbinder_reader_read_hidl_struct(&reader, PQHidlMemory);
+        if (memory)
+            fds = gbinder_reader_read_fds(&reader);
+    }
+
+    if (retval == 0 && (!fds || fds->num_fds < 1 || !memory->size)) {
+        g_debug("getAshmem returned no usable memory");
+        retval = -1;
+    }
+
+    if (retval == 0) {
+        /* The descriptor belongs to the reply, keep our own */
+        *fd = fcntl(((const int*)(fds + 1))[0], F_DUPFD_CLOEXEC, 0);
+        *size = memory->size;
+        if (*fd < 0)
             retval = -1;
-        } else {
-            gbinder_reader_read_bool(&reader, &is_enabled);
-            retval = 1 ? is_enabled : 0;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getBlueLightEnabled, transaction failed with status %d", status);
     }
 
     gbinder_local_request_unref(req);
     gbinder_remote_reply_unref(reply);
-
     return retval;
 }
 
-int
-set_blue_light_strength_hidl(GBinderClient* client,
-                             const int strength,
-                             const int step,
-                             GSettings *settings)
+static void
+pq_binder_on_died(GBinderRemoteObject* remote,
+                  void* user_data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    pq_transport_died(user_data);
+}
 
-    // setBlueLightStrength
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, strength);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_BLUE_LIGHT_STRENGTH, req, &status);
+static const PQTransport pq_binder_transport = {
+    .name = "binder",
+    .open = pq_binder_open,
+    .close = pq_binder_close,
+    .connect = pq_binder_connect,
+    .lookup = pq_binder_lookup,
+    .watch = pq_binder_watch,
+    .disconnect = pq_binder_disconnect,
+    .call = pq_binder_call,
+    .call_async = pq_binder_call_async,
+    .cancel = pq_binder_cancel,
+    .get_ashmem = pq_binder_get_ashmem,
+};
+
+const char *
+pq_function_name(const int func)
+{
+    if (func <= 0 || func >= PQ_FUNCTION_MAX)
+        return NULL;
+    return pq_functions[func].name;
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setBlueLightStrength failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setBlueLightStrength, transaction failed with status %d", status);
-    }
+const char *
+pq_function_args(const int func)
+{
+    if (!pq_function_name(func))
+        return NULL;
+    return pq_functions[func].args;
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+const char *
+pq_function_reply(const int func)
+{
+    if (!pq_function_name(func))
+        return NULL;
+    return pq_functions[func].reply;
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "blue-light-strength", strength);
-        g_settings_sync();
-    }
+int
+pq_call(PQContext* ctx,
+        const int func,
+        const PQArg* args,
+        gint32 *out)
+{
+    gint32 value = 0;
 
-    return retval;
+    if (!ctx || !ctx->connected || !pq_function_name(func))
+        return -1;
+
+    return ctx->transport->call(ctx, func, args, out ? out : &value);
 }
 
 int
-get_blue_light_strength_hidl(GBinderClient* client)
+pq_set_color_transform(PQContext* ctx,
+                       const gfloat *matrix,
+                       const int hint,
+                       const int step)
 {
-    gint status = 0, retval = 0, strength = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQArg args[PQ_MAX_ARGS] = { 0 };
 
-    // getBlueLightStrength
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_BLUE_LIGHT_STRENGTH, req, &status);
-
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getBlueLightStrength failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_uint32(&reader, &strength);
-            retval = strength;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getBlueLightStrength, transaction failed with status %d", status);
-    }
+    if (!ctx || !matrix)
+        return -1;
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    memcpy(ctx->color_transform, matrix, sizeof(ctx->color_transform));
+    ctx->color_transform_hint = hint;
+    ctx->color_transform_step = step;
+    ctx->color_transform_valid = TRUE;
 
-    return retval;
+    args[0].m = matrix;
+    args[1].i = hint;
+    args[2].i = step;
+    return pq_call(ctx, SET_COLOR_TRANSFORM, args, NULL);
 }
 
-int
-enable_chameleon_hidl(GBinderClient* client,
-                      const int enable,
-                      const int step,
-                      GSettings *settings)
+/* One entry of the context's FIFO, a setting write or a plain call */
+typedef struct {
+    PQContext* ctx;
+    int setting;
+    int value;
+    int step;
+    GSettings *settings;
+
+    /* Calls queued by pq_call_async(), setting is 0 for those */
+    int func;
+    PQArg args[PQ_MAX_ARGS];
+    gfloat matrix[PQ_COLOR_MATRIX_SIZE];
+    gint32 reply;
+} PQSetCall;
+
+static void
+pq_set_call_free(gpointer data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQSetCall *call = data;
 
-    // enableChameleon
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_bool(&writer, enable);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, ENABLE_CHAMELEON, req, &status);
+    if (call->settings)
+        g_object_unref(call->settings);
+    g_free(call);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("enableChameleon failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call enableChameleon, transaction failed with status %d", status);
-    }
+static void pq_dispatch_next(PQContext* ctx);
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+const char *
+pq_setting_key(const int setting)
+{
+    if (setting <= 0 || setting >= PQ_SETTING_MAX)
+        return NULL;
+    return pq_settings[setting].key;
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "chameleon", enable);
-        g_settings_sync();
-    }
+static void
+pq_setting_persist(GSettings *settings,
+                   const PQSettingInfo* info,
+                   const int value)
+{
+    if (!settings)
+        return;
 
-    return retval;
+    if (g_settings_get_int(settings, info->key) != value)
+        pq_settings_write(settings, info->key, value);
 }
 
-int
-get_chameleon_enabled_hidl(GBinderClient* client)
+/*
+ * Record value as the last one sent for setting. Returns FALSE when the
+ * HAL is already known to hold it and the transaction can be skipped.
+ */
+static gboolean
+pq_shadow_update(PQContext* ctx,
+                 const int setting,
+                 const int value)
 {
-    gint status = 0, retval = 0;
-    gboolean is_enabled = FALSE;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    if (ctx->shadow_valid[setting] && ctx->shadow[setting] == value) {
+        ctx->cache_hits++;
+        return FALSE;
+    }
 
-    // getChameleonEnabled
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_CHAMELEON_ENABLED, req, &status);
+    ctx->cache_misses++;
+    ctx->shadow[setting] = value;
+    ctx->shadow_valid[setting] = TRUE;
+    return TRUE;
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getChameleonEnabled failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_bool(&reader, &is_enabled);
-            retval = 1 ? is_enabled : 0;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getChameleonEnabled, transaction failed with status %d", status);
-    }
+static void
+pq_desired_update(PQContext* ctx,
+                  const int setting,
+                  const int value,
+                  const int step)
+{
+    ctx->desired[setting] = value;
+    ctx->desired_step[setting] = step;
+    ctx->desired_valid[setting] = TRUE;
+}
+
+void
+pq_invalidate_cache(PQContext* ctx)
+{
+    if (!ctx)
+        return;
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    for (int i = 0; i < PQ_SETTING_MAX; i++)
+        ctx->shadow_valid[i] = FALSE;
+}
 
-    return retval;
+void
+pq_get_cache_stats(PQContext* ctx,
+                   guint *hits,
+                   guint *misses)
+{
+    if (hits)
+        *hits = ctx ? ctx->cache_hits : 0;
+    if (misses)
+        *misses = ctx ? ctx->cache_misses : 0;
 }
 
 int
-set_chameleon_strength_hidl(GBinderClient* client,
-                            const int strength,
-                            const int step,
-                            GSettings *settings)
+pq_get_setting(PQContext* ctx,
+               const int setting,
+               int *value)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    const PQSettingInfo* info;
+    PQArg args[1];
+    gint32 current = 0;
 
-    // setChameleonStrength
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, strength);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_CHAMELEON_STRENGTH, req, &status);
+    if (!ctx || !ctx->connected || !pq_setting_key(setting))
+        return -1;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setChameleonStrength failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setChameleonStrength, transaction failed with status %d", status);
-    }
+    info = &pq_settings[setting];
+    /* The HAL has no getter for pq-mode */
+    if (info->get_func < 0)
+        return -1;
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    if (info->feature >= 0)
+        args[0].i = info->feature;
 
-    if (settings) {
-        g_settings_set_int(settings, "chameleon-strength", strength);
-        g_settings_sync();
-    }
+    if (ctx->transport->call(ctx, info->get_func, args, &current) != 0)
+        return -1;
 
-    return retval;
+    *value = current;
+    return 0;
 }
 
 int
-get_chameleon_strength_hidl(GBinderClient* client)
+pq_set_setting(PQContext* ctx,
+               const int setting,
+               const int value,
+               const int step,
+               GSettings *settings)
 {
-    gint status = 0, retval = 0, strength = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    const PQSettingInfo* info;
+    PQArg args[PQ_MAX_ARGS];
+    gint32 reply = 0;
+    int retval = 0;
 
-    // getChameleonStrength
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_CHAMELEON_STRENGTH, req, &status);
+    if (!ctx || !pq_setting_key(setting))
+        return -1;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getBlueLightStrength failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &strength);
-            retval = strength;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getBlueLightStrength, transaction failed with status %d", status);
+    info = &pq_settings[setting];
+    pq_transition_cancel(ctx, setting);
+    pq_desired_update(ctx, setting, value, step);
+
+    /* Replayed once the HAL is back */
+    if (!ctx->connected) {
+        pq_setting_persist(settings, info, value);
+        return -1;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    if (pq_shadow_update(ctx, setting, value)) {
+        pq_setting_args(info, value, step, args);
+        retval = ctx->transport->call(ctx, info->func, args, &reply);
+        if (retval != 0)
+            ctx->shadow_valid[setting] = FALSE;
+    }
+
+    pq_setting_persist(settings, info, value);
 
     return retval;
 }
 
-int
-set_tuning_field_hidl(GBinderClient* client,
-                      const int pq_module,
-                      const int field,
-                      const int value)
+static void
+pq_set_setting_reply(PQContext* ctx,
+                     int retval,
+                     gint32 value,
+                     gpointer user_data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    GTask *task = user_data;
+    PQSetCall *call = g_task_get_task_data(task);
 
-    // setTuningField
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, pq_module);
-    gbinder_writer_append_int32(&writer, field);
-    gbinder_writer_append_int32(&writer, value);
-    reply = gbinder_client_transact_sync_reply(client, SET_TUNING_FIELD, req, &status);
+    if (call->setting) {
+        if (retval != 0)
+            ctx->shadow_valid[call->setting] = FALSE;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setTuningField failed, PQ returned the value %d", retval);
-            retval = -1;
-        }
+        pq_setting_persist(call->settings, &pq_settings[call->setting], call->value);
     } else {
-        retval = status;
-        g_debug("Failed to call setTuningField, transaction failed with status %d", status);
+        call->reply = value;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    ctx->in_flight = NULL;
+    ctx->in_flight_id = 0;
+    g_task_return_int(task, retval);
 
-    return retval;
+    pq_dispatch_next(ctx);
 }
 
-int
-get_tuning_field_hidl(GBinderClient* client,
-                      const int pq_module,
-                      const int field)
+static void
+pq_dispatch_next(PQContext* ctx)
 {
-    gint status = 0, retval = 0, value = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // getTuningField
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, pq_module);
-    gbinder_writer_append_int32(&writer, field);
-    reply = gbinder_client_transact_sync_reply(client, GET_TUNING_FIELD, req, &status);
+    GTask *task;
+
+    /* While disconnected the queue is kept until the HAL is back */
+    while (ctx->connected && !ctx->in_flight && (task = g_queue_pop_head(ctx->pending))) {
+        PQSetCall *call = g_task_get_task_data(task);
+        PQArg args[PQ_MAX_ARGS];
+        int func = call->func;
+
+        if (g_task_return_error_if_cancelled(task)) {
+            if (call->setting)
+                ctx->shadow_valid[call->setting] = FALSE;
+            g_object_unref(task);
+            continue;
+        }
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getTuningField failed, PQ returned the value %d", retval);
-            retval = -1;
+        if (call->setting) {
+            func = pq_settings[call->setting].func;
+            pq_setting_args(&pq_settings[call->setting], call->value, call->step, args);
         } else {
-            gbinder_reader_read_int32(&reader, &value);
-            retval = value;
+            memcpy(args, call->args, sizeof(args));
         }
-    } else {
-        retval = status;
-        g_debug("Failed to call getTuningField, transaction failed with status %d", status);
+
+        ctx->in_flight = task;
+        ctx->in_flight_id = ctx->transport->call_async(ctx, func, args,
+                                                       pq_set_setting_reply, task,
+                                                       g_object_unref);
+
+        if (!ctx->in_flight_id) {
+            ctx->in_flight = NULL;
+            if (call->setting)
+                ctx->shadow_valid[call->setting] = FALSE;
+            g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                    "Failed to submit %s", pq_functions[func].name);
+            g_object_unref(task);
+        }
+    }
+}
+
+void
+pq_queue_setting(PQContext* ctx,
+                 const int setting,
+                 const int value,
+                 const int step,
+                 GSettings *settings,
+                 GCancellable *cancellable,
+                 GAsyncReadyCallback callback,
+                 gpointer user_data)
+{
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    PQSetCall *call;
+
+    g_task_set_source_tag(task, pq_set_setting_async);
+
+    if (!ctx || !pq_setting_key(setting)) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Invalid PQ setting %d", setting);
+        g_object_unref(task);
+        return;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    pq_desired_update(ctx, setting, value, step);
 
-    return retval;
+    /*
+     * The shadow holds the last value queued, so a write matching it
+     * still lands last even while earlier calls are pending.
+     */
+    if (!pq_shadow_update(ctx, setting, value)) {
+        pq_setting_persist(settings, &pq_settings[setting], value);
+        g_task_return_int(task, 0);
+        g_object_unref(task);
+        return;
+    }
+
+    call = g_new0(PQSetCall, 1);
+    call->ctx = ctx;
+    call->setting = setting;
+    call->value = value;
+    call->step = step;
+    call->settings = settings ? g_object_ref(settings) : NULL;
+    g_task_set_task_data(task, call, pq_set_call_free);
+
+    g_queue_push_tail(ctx->pending, task);
+    pq_dispatch_next(ctx);
+}
+
+void
+pq_set_setting_async(PQContext* ctx,
+                     const int setting,
+                     const int value,
+                     const int step,
+                     GSettings *settings,
+                     GCancellable *cancellable,
+                     GAsyncReadyCallback callback,
+                     gpointer user_data)
+{
+    /* An explicit value replaces a running fade */
+    pq_transition_cancel(ctx, setting);
+    pq_queue_setting(ctx, setting, value, step, settings, cancellable, callback, user_data);
 }
 
 int
-set_ambient_light_ct_hidl(GBinderClient* client,
-                          gdouble input_x,
-                          gdouble input_y,
-                          gdouble input_Y)
+pq_set_setting_finish(GAsyncResult *result,
+                      GError **error)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    GError *local_error = NULL;
+    gssize retval;
 
-    // setAmbientLightCT
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_double(&writer, input_x);
-    gbinder_writer_append_double(&writer, input_y);
-    gbinder_writer_append_double(&writer, input_Y);
-    reply = gbinder_client_transact_sync_reply(client, SET_AMBIENT_LIGHT_CT, req, &status);
+    g_return_val_if_fail(g_task_is_valid(result, NULL), -1);
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setAmbientLightCT failed, PQ returned the value %d", retval);
-            retval = -1;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setAmbientLightCT, transaction failed with status %d", status);
+    retval = g_task_propagate_int(G_TASK(result), &local_error);
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        return -1;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    return retval;
+    return (int)retval;
 }
 
-int
-set_ambient_light_rgbw_hidl(GBinderClient* client,
-                            const int input_R,
-                            const int input_G,
-                            const int input_B,
-                            const int input_W)
+void
+pq_call_async(PQContext* ctx,
+              const int func,
+              const PQArg* args,
+              GCancellable *cancellable,
+              GAsyncReadyCallback callback,
+              gpointer user_data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    const char *layout = pq_function_args(func);
+    PQSetCall *call;
 
-    // setAmbientLightRGBW
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, input_R);
-    gbinder_writer_append_int32(&writer, input_G);
-    gbinder_writer_append_int32(&writer, input_B);
-    gbinder_writer_append_int32(&writer, input_W);
-    reply = gbinder_client_transact_sync_reply(client, SET_AMBIENT_LIGHT_RGBW, req, &status);
+    g_task_set_source_tag(task, pq_call_async);
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setAmbientLightRGBW failed, PQ returned the value %d", retval);
-            retval = -1;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setAmbientLightRGBW, transaction failed with status %d", status);
+    if (!ctx || !layout) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Invalid PQ function %d", func);
+        g_object_unref(task);
+        return;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    call = g_new0(PQSetCall, 1);
+    call->ctx = ctx;
+    call->func = func;
+    for (int i = 0; layout[i]; i++) {
+        call->args[i] = args[i];
+        /* The caller's matrix may be gone by the time the call is sent */
+        if (layout[i] == 'm') {
+            memcpy(call->matrix, args[i].m, sizeof(call->matrix));
+            call->args[i].m = call->matrix;
+        }
+    }
+    g_task_set_task_data(task, call, pq_set_call_free);
 
-    return retval;
+    g_queue_push_tail(ctx->pending, task);
+    pq_dispatch_next(ctx);
 }
 
 int
-set_gamma_index_hidl(GBinderClient* client,
-                     const int index,
-                     const int step,
-                     GSettings *settings)
+pq_call_finish(GAsyncResult *result,
+               gint32 *out,
+               GError **error)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
-
-    // setGammaIndex
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_bool(&writer, index);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_GAMMA_INDEX, req, &status);
+    PQSetCall *call;
+    int retval = pq_set_setting_finish(result, error);
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setGammaIndex failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setGammaIndex, transaction failed with status %d", status);
+    if (retval == 0 && out) {
+        call = g_task_get_task_data(G_TASK(result));
+        *out = call->reply;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return retval;
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "gamma-index", index);
-        g_settings_sync();
+void
+pq_get_setting_async(PQContext* ctx,
+                     const int setting,
+                     GCancellable *cancellable,
+                     GAsyncReadyCallback callback,
+                     gpointer user_data)
+{
+    const PQSettingInfo* info;
+    PQArg args[PQ_MAX_ARGS] = { 0 };
+    GTask *task;
+
+    if (!ctx || !pq_setting_key(setting) || pq_settings[setting].get_func < 0) {
+        task = g_task_new(NULL, cancellable, callback, user_data);
+        g_task_set_source_tag(task, pq_call_async);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                "PQ setting %d can't be read", setting);
+        g_object_unref(task);
+        return;
     }
 
+    info = &pq_settings[setting];
+    if (info->feature >= 0)
+        args[0].i = info->feature;
+
+    pq_call_async(ctx, info->get_func, args, cancellable, callback, user_data);
+}
+
+int
+pq_get_setting_finish(GAsyncResult *result,
+                      int *value,
+                      GError **error)
+{
+    gint32 current = 0;
+    int retval = pq_call_finish(result, &current, error);
+
+    if (retval == 0)
+        *value = current;
     return retval;
 }
 
 int
-get_gamma_index_hidl(GBinderClient* client)
+pq_sync_settings(PQContext* ctx,
+                 GSettings *settings,
+                 const int step)
 {
-    gint status = 0, retval = 0, index = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    int applied = 0;
 
-    // getGammaIndex
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_GAMMA_INDEX, req, &status);
+    if (!ctx || !settings)
+        return -1;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getGammaIndex failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &index);
-            retval = index;
+    for (int setting = PQ_SETTING_PQ_MODE; setting < PQ_SETTING_MAX; setting++) {
+        int desired = g_settings_get_int(settings, pq_settings[setting].key);
+        int current;
+
+        /* Requested since startup, newer than what is stored */
+        if (ctx->desired_valid[setting])
+            continue;
+
+        if (pq_get_setting(ctx, setting, &current) == 0 && current == desired) {
+            pq_desired_update(ctx, setting, desired, step);
+            ctx->shadow[setting] = current;
+            ctx->shadow_valid[setting] = TRUE;
+            continue;
         }
-    } else {
-        retval = status;
-        g_debug("Failed to call getGammaIndex, transaction failed with status %d", status);
+
+        g_debug("Restoring %s to %d", pq_settings[setting].key, desired);
+        /* The value came from settings, writing it back would be a no-op */
+        pq_queue_setting(ctx, setting, desired, step, NULL, NULL, NULL, NULL);
+        applied++;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    return applied;
+}
 
-    return retval;
+typedef struct {
+    PQContext* ctx;
+    int step;
+    /* Reads still out, plus one while they are being queued */
+    int outstanding;
+    int applied;
+} PQSyncState;
+
+typedef struct {
+    GTask *task;
+    int setting;
+    int desired;
+} PQSyncRead;
+
+static void
+pq_sync_restore(PQSyncState *state,
+                const int setting,
+                const int desired)
+{
+    g_debug("Restoring %s to %d", pq_settings[setting].key, desired);
+    /* The value came from settings, writing it back would be a no-op */
+    pq_queue_setting(state->ctx, setting, desired, state->step, NULL, NULL, NULL, NULL);
+    state->applied++;
 }
 
-int
-set_external_panel_nits_hidl(GBinderClient* client,
-                             const int nits)
+static void
+pq_sync_release(GTask *task)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQSyncState *state = g_task_get_task_data(task);
 
-    // setExternalPanelNits
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, nits);
-    reply = gbinder_client_transact_sync_reply(client, SET_EXTERNAL_PANEL_NITS, req, &status);
+    if (--state->outstanding == 0)
+        g_task_return_int(task, state->applied);
+    g_object_unref(task);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setExternalPanelNits failed, PQ returned the value %d", retval);
-        }
+static void
+pq_on_sync_read(GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    PQSyncRead *read = user_data;
+    PQSyncState *state = g_task_get_task_data(read->task);
+    GError *error = NULL;
+    int current = 0;
+    int ret = pq_get_setting_finish(result, &current, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* The context is going away */
+    } else if (state->ctx->desired_valid[read->setting]) {
+        /* Requested while the read was queued, that value is newer */
+    } else if (ret == 0 && current == read->desired) {
+        pq_desired_update(state->ctx, read->setting, read->desired, state->step);
+        state->ctx->shadow[read->setting] = current;
+        state->ctx->shadow_valid[read->setting] = TRUE;
     } else {
-        retval = status;
-        g_debug("Failed to call setExternalPanelNits, transaction failed with status %d", status);
+        pq_sync_restore(state, read->setting, read->desired);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    return retval;
+    g_clear_error(&error);
+    pq_sync_release(read->task);
+    g_free(read);
 }
 
-int
-get_external_panel_nits_hidl(GBinderClient* client)
+void
+pq_sync_settings_async(PQContext* ctx,
+                       GSettings *settings,
+                       const int step,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
 {
-    gint status = 0, retval = 0, nits = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+    PQSyncState *state;
+
+    g_task_set_source_tag(task, pq_sync_settings_async);
+
+    if (!ctx || !settings) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "No PQ context or settings to sync");
+        g_object_unref(task);
+        return;
+    }
+
+    state = g_new0(PQSyncState, 1);
+    state->ctx = ctx;
+    state->step = step;
+    state->outstanding = 1;
+    g_task_set_task_data(task, state, g_free);
+
+    for (int setting = PQ_SETTING_PQ_MODE; setting < PQ_SETTING_MAX; setting++) {
+        int desired = g_settings_get_int(settings, pq_settings[setting].key);
+        PQSyncRead *read;
 
-    // getExternalPanelNits
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_EXTERNAL_PANEL_NITS, req, &status);
+        /* Requested since startup, newer than what is stored */
+        if (ctx->desired_valid[setting])
+            continue;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getExternalPanelNits failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &nits);
-            retval = nits;
+        /* Nothing to compare with, write it */
+        if (!ctx->connected || pq_settings[setting].get_func < 0) {
+            pq_sync_restore(state, setting, desired);
+            continue;
         }
-    } else {
-        retval = status;
-        g_debug("Failed to call getExternalPanelNits, transaction failed with status %d", status);
-    }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+        read = g_new0(PQSyncRead, 1);
+        read->task = g_object_ref(task);
+        read->setting = setting;
+        read->desired = desired;
+        state->outstanding++;
+        pq_get_setting_async(ctx, setting, NULL, pq_on_sync_read, read);
+    }
 
-    return retval;
+    pq_sync_release(task);
 }
 
 int
-set_rgb_gain_hidl(GBinderClient* client,
-                  const int r_gain,
-                  const int g_gain,
-                  const int b_gain,
-                  const int step)
+pq_sync_settings_finish(GAsyncResult *result,
+                        GError **error)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    return pq_set_setting_finish(result, error);
+}
 
-    // setRGBGain
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, r_gain);
-    gbinder_writer_append_int32(&writer, g_gain);
-    gbinder_writer_append_int32(&writer, b_gain);
-    gbinder_writer_append_int32(&writer, step);
-    reply = gbinder_client_transact_sync_reply(client, SET_RGB_GAIN, req, &status);
+void
+pq_set_reconnect_func(PQContext* ctx,
+                      PQReconnectFunc func,
+                      gpointer user_data)
+{
+    if (!ctx)
+        return;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setRGBGain failed, PQ returned the value %d", retval);
-            retval = -1;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setRGBGain, transaction failed with status %d", status);
-    }
+    ctx->reconnect_func = func;
+    ctx->reconnect_data = user_data;
+}
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+static void
+pq_replay_done(PQContext* ctx)
+{
+    if (ctx->reconnect_func)
+        ctx->reconnect_func(ctx, ctx->reconnect_data);
+}
 
-    return retval;
+static void
+pq_replay_release(PQContext* ctx)
+{
+    if (--ctx->replay_pending == 0)
+        pq_replay_done(ctx);
 }
 
-int
-set_global_pq_switch_hidl(GBinderClient* client,
-                          const int mode,
-                          GSettings *settings)
+static void
+pq_on_replay_applied(GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    PQContext* ctx = user_data;
+    GError *error = NULL;
+    int ret = pq_set_setting_finish(result, &error);
 
-    // setGlobalPQSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, mode);
-    reply = gbinder_client_transact_sync_reply(client, SET_GLOBAL_PQ_SWITCH, req, &status);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* The context is going away */
+        g_error_free(error);
+        return;
+    }
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setGlobalPQSwitch failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setGlobalPQSwitch, transaction failed with status %d", status);
+    if (error) {
+        g_warning("Failed to restore PQ setting after HAL restart: %s", error->message);
+        g_error_free(error);
+    } else if (ret != 0) {
+        g_warning("Failed to restore PQ setting after HAL restart: %d", ret);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    pq_replay_release(ctx);
+}
 
-    if (settings) {
-        g_settings_set_int(settings, "global-pq-switch", mode);
-        g_settings_sync();
+static gboolean
+pq_setting_is_pending(PQContext* ctx,
+                      const int setting)
+{
+    PQSetCall *call;
+
+    if (ctx->in_flight) {
+        call = g_task_get_task_data(ctx->in_flight);
+        if (call->setting == setting)
+            return TRUE;
     }
 
-    return retval;
+    for (GList *l = ctx->pending->head; l; l = l->next) {
+        call = g_task_get_task_data(l->data);
+
+        if (call->setting == setting)
+            return TRUE;
+    }
+    return FALSE;
 }
 
-int
-get_global_pq_switch_hidl(GBinderClient* client)
+typedef struct {
+    PQContext* ctx;
+    int setting;
+    int desired;
+} PQReplayRead;
+
+static void
+pq_replay_setting(PQContext* ctx,
+                  const int setting)
 {
-    gint status = 0, retval = 0, switch_value = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    g_debug("Replaying %s = %d", pq_settings[setting].key, ctx->desired[setting]);
+    /* Already persisted when it was requested */
+    pq_queue_setting(ctx, setting, ctx->desired[setting], ctx->desired_step[setting],
+                     NULL, NULL, pq_on_replay_applied, ctx);
+}
 
-    // getGlobalPQSwitch
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_GLOBAL_PQ_SWITCH, req, &status);
+static void
+pq_on_replay_read(GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    PQReplayRead *read = user_data;
+    PQContext* ctx = read->ctx;
+    GError *error = NULL;
+    int current = 0;
+    int ret = pq_get_setting_finish(result, &current, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* The context is going away */
+        g_error_free(error);
+        g_free(read);
+        return;
+    }
+    g_clear_error(&error);
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getGlobalPQSwitch failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &switch_value);
-            retval = switch_value;
-        }
+    if (ctx->desired[read->setting] != read->desired || pq_setting_is_pending(ctx, read->setting)) {
+        /* Requested again while the read was queued, that write covers it */
+    } else if (ret == 0 && current == read->desired) {
+        ctx->shadow[read->setting] = current;
+        ctx->shadow_valid[read->setting] = TRUE;
     } else {
-        retval = status;
-        g_debug("Failed to call getGlobalPQSwitch, transaction failed with status %d", status);
+        /* pq_on_replay_applied() releases it */
+        pq_replay_setting(ctx, read->setting);
+        g_free(read);
+        return;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
-
-    return retval;
+    g_free(read);
+    pq_replay_release(ctx);
 }
 
-int
-set_global_pq_strength_hidl(GBinderClient* client,
-                            const int strength,
-                            GSettings *settings)
+/*
+ * Bring a fresh HAL instance in line with the desired state. Settings
+ * still queued are sent by the queue itself, everything else is read back
+ * through the queue and only written when the new instance reports a
+ * different value.
+ */
+static void
+pq_replay_desired(PQContext* ctx)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    /* Held until every replay below was at least queued */
+    ctx->replay_pending++;
 
-    // setGlobalPQStrength
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, strength);
-    reply = gbinder_client_transact_sync_reply(client, SET_GLOBAL_PQ_STRENGTH, req, &status);
+    /* Calls left over from before the death go first */
+    pq_dispatch_next(ctx);
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setGlobalPQStrength failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setGlobalPQStrength, transaction failed with status %d", status);
+    /* Not a setting and there is no getter, always send it again */
+    if (ctx->color_transform_valid) {
+        PQArg args[PQ_MAX_ARGS] = { { .m = ctx->color_transform },
+                                    { .i = ctx->color_transform_hint },
+                                    { .i = ctx->color_transform_step } };
+
+        ctx->replay_pending++;
+        pq_call_async(ctx, SET_COLOR_TRANSFORM, args, NULL, pq_on_replay_applied, ctx);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    for (int setting = PQ_SETTING_PQ_MODE; setting < PQ_SETTING_MAX; setting++) {
+        PQReplayRead *read;
 
-    if (settings) {
-        g_settings_set_int(settings, "global-pq-strength", strength);
-        g_settings_sync();
+        if (!ctx->desired_valid[setting] || pq_setting_is_pending(ctx, setting))
+            continue;
+
+        ctx->replay_pending++;
+
+        /* Nothing to compare with, write it */
+        if (pq_settings[setting].get_func < 0) {
+            pq_replay_setting(ctx, setting);
+            continue;
+        }
+
+        read = g_new0(PQReplayRead, 1);
+        read->ctx = ctx;
+        read->setting = setting;
+        read->desired = ctx->desired[setting];
+        pq_get_setting_async(ctx, setting, NULL, pq_on_replay_read, read);
     }
 
-    return retval;
+    /* Replays queued before another death are still on their way */
+    pq_replay_release(ctx);
 }
 
-int
-get_global_pq_strength_hidl(GBinderClient* client)
-{
-    gint status = 0, retval = 0, strength = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+static gboolean pq_reconnect_timeout(gpointer user_data);
 
-    // getGlobalPQStrength
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_GLOBAL_PQ_STRENGTH, req, &status);
+/* Looks the service up without blocking, retrying with backoff */
+static void
+pq_try_reconnect(PQContext* ctx)
+{
+    if (ctx->connected || ctx->connecting)
+        return;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getGlobalPQStrength failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &strength);
-            retval = strength;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getGlobalPQStrength, transaction failed with status %d", status);
+    if (ctx->reconnect_id) {
+        g_source_remove(ctx->reconnect_id);
+        ctx->reconnect_id = 0;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    ctx->connecting = TRUE;
+    ctx->transport->lookup(ctx);
+}
 
-    return retval;
+static gboolean
+pq_reconnect_timeout(gpointer user_data)
+{
+    PQContext* ctx = user_data;
+
+    ctx->reconnect_id = 0;
+    pq_try_reconnect(ctx);
+    return G_SOURCE_REMOVE;
 }
 
-int
-set_global_pq_stable_status_hidl(GBinderClient* client,
-                                 const int stable)
+static void
+pq_wait_for_service(PQContext* ctx)
 {
-    gint status = 0, retval = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    ctx->reconnect_delay_ms = PQ_RECONNECT_MIN_MS;
+    ctx->transport->watch(ctx, TRUE);
 
-    // setGlobalPQStableStatus
-    gbinder_local_request_init_writer(req, &writer);
-    gbinder_writer_append_int32(&writer, stable);
-    reply = gbinder_client_transact_sync_reply(client, SET_GLOBAL_PQ_STABLE_STATUS, req, &status);
+    /* The registration watch is not guaranteed to fire, poll as well */
+    pq_try_reconnect(ctx);
+}
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("setGlobalPQStableStatus failed, PQ returned the value %d", retval);
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call setGlobalPQStableStatus, transaction failed with status %d", status);
+void
+pq_transport_found(PQContext* ctx,
+                   gboolean connected)
+{
+    ctx->connecting = FALSE;
+
+    if (!connected) {
+        ctx->reconnect_id = g_timeout_add(ctx->reconnect_delay_ms, pq_reconnect_timeout, ctx);
+        ctx->reconnect_delay_ms = MIN(ctx->reconnect_delay_ms * 2, PQ_RECONNECT_MAX_MS);
+        return;
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    g_message("IPictureQuality service is available (%s)", ctx->transport->name);
+    ctx->connected = TRUE;
+    ctx->transport->watch(ctx, FALSE);
 
-    return retval;
+    pq_replay_desired(ctx);
 }
 
-int
-get_global_pq_stable_status_hidl(GBinderClient* client)
+void
+pq_transport_registered(PQContext* ctx)
 {
-    gint status = 0, retval = 0, stable = 0;
-    GBinderLocalRequest* req = gbinder_client_new_request(client);
-    GBinderWriter writer;
-    GBinderReader reader;
-    GBinderRemoteReply* reply;
+    ctx->reconnect_delay_ms = PQ_RECONNECT_MIN_MS;
+    pq_try_reconnect(ctx);
+}
 
-    // getGlobalPQStableStatus
-    gbinder_local_request_init_writer(req, &writer);
-    reply = gbinder_client_transact_sync_reply(client, GET_GLOBAL_PQ_STABLE_STATUS, req, &status);
+void
+pq_transport_died(PQContext* ctx)
+{
+    if (!ctx->connected)
+        return;
 
-    gbinder_remote_reply_init_reader(reply, &reader);
-    gbinder_reader_read_int32(&reader, &status);
-    if (status == 0) {
-        gbinder_reader_read_int32(&reader, &retval);
-        if (retval != 0) {
-            g_debug("getGlobalPQStableStatus failed, PQ returned the value %d", retval);
-            retval = -1;
-        } else {
-            gbinder_reader_read_int32(&reader, &stable);
-            retval = stable;
-        }
-    } else {
-        retval = status;
-        g_debug("Failed to call getGlobalPQStableStatus, transaction failed with status %d", status);
+    /* A restarted HAL comes back with its own defaults */
+    g_warning("IPictureQuality service died, waiting for it to come back");
+
+    if (ctx->in_flight) {
+        GTask *task = g_object_ref(ctx->in_flight);
+
+        /* Cancelling drops the reply handler's reference on the task */
+        ctx->transport->cancel(ctx, ctx->in_flight_id);
+        ctx->in_flight = NULL;
+        ctx->in_flight_id = 0;
+        /* It never got an answer, send it again first once reconnected */
+        g_queue_push_head(ctx->pending, task);
     }
 
-    gbinder_local_request_unref(req);
-    gbinder_remote_reply_unref(reply);
+    ctx->transport->disconnect(ctx);
+    ctx->connected = FALSE;
+    pq_invalidate_cache(ctx);
+    pq_wait_for_service(ctx);
+}
 
-    return retval;
+static const PQTransport *
+pq_transport_for_backend(PQBackend backend)
+{
+    if (backend == PQ_BACKEND_DEFAULT) {
+        const char *name = g_getenv("PQ_BACKEND");
+
+        backend = g_strcmp0(name, "fake") == 0 ? PQ_BACKEND_FAKE : PQ_BACKEND_BINDER;
+    }
+
+    return backend == PQ_BACKEND_FAKE ? &pq_fake_transport : &pq_binder_transport;
 }
 
-PQContext *
-init_pq_hidl(void)
+static PQContext *
+pq_context_alloc(PQBackend backend)
 {
-    PQContext* ctx = malloc(sizeof(PQContext));
+    PQContext* ctx = calloc(1, sizeof(PQContext));
     if (!ctx) return NULL;
 
-    ctx->sm = NULL;
-    ctx->remote = NULL;
-    ctx->client = NULL;
+    ctx->transport = pq_transport_for_backend(backend);
+    ctx->pending = g_queue_new();
+    ctx->reconnect_delay_ms = PQ_RECONNECT_MIN_MS;
+    pq_invalidate_cache(ctx);
 
-    ctx->sm = gbinder_servicemanager_new("/dev/hwbinder");
-    if (!ctx->sm) {
+    if (!ctx->transport->open(ctx)) {
+        g_queue_free(ctx->pending);
         free(ctx);
         return NULL;
     }
 
-    ctx->remote = gbinder_servicemanager_get_service_sync(ctx->sm,
-        "vendor.mediatek.hardware.pq@2.0::IPictureQuality/default", NULL);
-    if (!ctx->remote) {
-        gbinder_servicemanager_unref(ctx->sm);
-        free(ctx);
-        return NULL;
-    }
+    return ctx;
+}
 
-    ctx->client = gbinder_client_new(ctx->remote,
-        "vendor.mediatek.hardware.pq@2.0::IPictureQuality");
-    if (!ctx->client) {
-        gbinder_remote_object_unref(ctx->remote);
-        gbinder_servicemanager_unref(ctx->sm);
+PQContext *
+init_pq_hidl(void)
+{
+    PQContext* ctx = pq_context_alloc(PQ_BACKEND_DEFAULT);
+    if (!ctx) return NULL;
+
+    if (!ctx->transport->connect(ctx)) {
+        ctx->transport->close(ctx);
+        g_queue_free(ctx->pending);
         free(ctx);
         return NULL;
     }
 
+    ctx->connected = TRUE;
+    return ctx;
+}
+
+PQContext *
+pq_context_new_for_backend(PQBackend backend)
+{
+    PQContext* ctx = pq_context_alloc(backend);
+    if (!ctx) return NULL;
+
+    pq_wait_for_service(ctx);
     return ctx;
 }
 
+PQContext *
+pq_context_new(void)
+{
+    return pq_context_new_for_backend(PQ_BACKEND_DEFAULT);
+}
+
 void
 cleanup_pq_hidl(PQContext* ctx)
 {
+    GTask *task;
+
     if (!ctx)
         return;
-    if (ctx->client)
-        gbinder_client_unref(ctx->client);
-    if (ctx->remote)
-        gbinder_remote_object_unref(ctx->remote);
-    if (ctx->sm)
-        gbinder_servicemanager_unref(ctx->sm);
+
+    while ((task = g_queue_pop_head(ctx->pending))) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                "PQ context was destroyed");
+        g_object_unref(task);
+    }
+    g_queue_free(ctx->pending);
+
+    if (ctx->in_flight) {
+        /* Cancelling drops the reply handler's reference on the task */
+        g_task_return_new_error(ctx->in_flight, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                "PQ context was destroyed");
+        ctx->transport->cancel(ctx, ctx->in_flight_id);
+    }
+
+    if (ctx->reconnect_id)
+        g_source_remove(ctx->reconnect_id);
+    pq_transitions_free(ctx);
+    ctx->transport->close(ctx);
     free(ctx);
 }
 
@@ -1669,75 +1949,25 @@ run_pq_hidl(const int func,
 {
     int retval = 0;
 
-    GBinderServiceManager* sm = gbinder_servicemanager_new("/dev/hwbinder");
-    if (!sm)
-        return 1;
-
-    GBinderRemoteObject* remote = gbinder_servicemanager_get_service_sync(sm, "vendor.mediatek.hardware.pq@2.0::IPictureQuality/default", NULL);
-    if (!remote) {
-        gbinder_servicemanager_unref(sm);
-        return 1;
-    }
-
-    GBinderClient* client = gbinder_client_new(remote, "vendor.mediatek.hardware.pq@2.0::IPictureQuality");
-    if (!client) {
-        gbinder_remote_object_unref(remote);
-        gbinder_servicemanager_unref(sm);
+    PQContext* ctx = init_pq_hidl();
+    if (!ctx)
         return 1;
-    }
 
     GSettingsSchemaSource *schema_source = g_settings_schema_source_get_default();
     GSettingsSchema *schema = g_settings_schema_source_lookup(schema_source, "io.furios.pq", TRUE);
     GSettings *settings = schema ? g_settings_new("io.furios.pq") : NULL;
 
-    if (func == 1)
-        set_pq_mode_hidl(client, mode, 5, settings);
-    else if (func == 2)
-        enable_blue_light_hidl(client, mode, 5, settings);
-    else if (func == 3)
-        set_blue_light_strength_hidl(client, mode, 5, settings);
-    else if (func == 4)
-        enable_chameleon_hidl(client, mode, 5, settings);
-    else if (func == 5)
-        set_chameleon_strength_hidl(client, mode, 5, settings);
-    else if (func == 6)
-        set_gamma_index_hidl(client, mode, 5, settings);
-    else if (func == 7)
-        set_feature_display_color_hidl(client, mode, settings);
-    else if (func == 8)
-        set_feature_content_color_hidl(client, mode, settings);
-    else if (func == 9)
-        set_feature_content_color_video_hidl(client, mode, settings);
-    else if (func == 10)
-        set_feature_sharpness_hidl(client, mode, settings);
-    else if (func == 11)
-        set_feature_dynamic_contrast_hidl(client, mode, settings);
-    else if (func == 12)
-        set_feature_dynamic_sharpness_hidl(client, mode, settings);
-    else if (func == 13)
-        set_feature_display_ccorr_hidl(client, mode, settings);
-    else if (func == 14)
-        set_feature_display_gamma_hidl(client, mode, settings);
-    else if (func == 15)
-        set_feature_display_over_drive_hidl(client, mode, settings);
-    else if (func == 16)
-        set_feature_iso_adaptive_sharpness_hidl(client, mode, settings);
-    else if (func == 17)
-        set_feature_ultra_resolution_hidl(client, mode, settings);
-    else if (func == 18)
-        set_feature_video_hdr_hidl(client, mode, settings);
-    else if (func == 19)
-        set_global_pq_switch_hidl(client, mode, settings);
-    else if (func == 20)
-        set_global_pq_strength_hidl(client, mode, settings);
+    if (pq_setting_key(func))
+        pq_set_setting(ctx, func, mode, 5, settings);
     else
         retval = 1;
 
-cleanup:
-    gbinder_client_unref(client);
-    if (settings)
+    if (settings) {
+        pq_settings_flush(settings);
         g_object_unref(settings);
-    if (!remote)
-        gbinder_remote_object_unref(remote);
+    }
+    if (schema)
+        g_settings_schema_unref(schema);
+    cleanup_pq_hidl(ctx);
     return retval;
 }
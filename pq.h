@@ -72,19 +72,166 @@ enum PQFeatureID {
     PQ_FEATURE_MAX
 };
 
-typedef struct {
+enum PQSetting {
+    /* io.furios.pq keys, numbered like the pqcli function ids */
+    PQ_SETTING_PQ_MODE = 1,
+    PQ_SETTING_BLUE_LIGHT,
+    PQ_SETTING_BLUE_LIGHT_STRENGTH,
+    PQ_SETTING_CHAMELEON,
+    PQ_SETTING_CHAMELEON_STRENGTH,
+    PQ_SETTING_GAMMA_INDEX,
+    PQ_SETTING_DISPLAY_COLOR,
+    PQ_SETTING_CONTENT_COLOR,
+    PQ_SETTING_CONTENT_COLOR_VIDEO,
+    PQ_SETTING_SHARPNESS,
+    PQ_SETTING_DYNAMIC_CONTRAST,
+    PQ_SETTING_DYNAMIC_SHARPNESS,
+    PQ_SETTING_DISPLAY_CCORR,
+    PQ_SETTING_DISPLAY_GAMMA,
+    PQ_SETTING_DISPLAY_OVER_DRIVE,
+    PQ_SETTING_ISO_ADAPTIVE_SHARPNESS,
+    PQ_SETTING_ULTRA_RESOLUTION,
+    PQ_SETTING_VIDEO_HDR,
+    PQ_SETTING_GLOBAL_PQ_SWITCH,
+    PQ_SETTING_GLOBAL_PQ_STRENGTH,
+    PQ_SETTING_MAX
+};
+
+/* Maximum number of values a PQ call takes */
+#define PQ_MAX_ARGS 5
+
+/**
+ * One value of a PQ call, see pq_function_args() for which member is used
+ */
+typedef union {
+    gint32 i;
+    gdouble d;
+    /* PQ_COLOR_MATRIX_SIZE floats, row-major, must outlive the call */
+    const gfloat *m;
+} PQArg;
+
+/* A colour transform is a 4x4 matrix applied to (R, G, B, 1) */
+#define PQ_COLOR_MATRIX_SIZE 16
+
+/**
+ * Where a PQContext sends its calls
+ */
+typedef enum {
+    /* PQ_BACKEND environment variable, "fake" or the vendor HAL */
+    PQ_BACKEND_DEFAULT = 0,
+    /* vendor.mediatek.hardware.pq@2.0 over /dev/hwbinder */
+    PQ_BACKEND_BINDER,
+    /* In-process stand-in, see pq_fake_configure() */
+    PQ_BACKEND_FAKE
+} PQBackend;
+
+typedef struct _PQContext PQContext;
+typedef struct _PQTransport PQTransport;
+
+/**
+ * Called once the HAL came back and the desired state was replayed
+ *
+ * @param ctx PQContext that reconnected
+ * @param user_data Data passed to pq_set_reconnect_func
+ */
+typedef void (*PQReconnectFunc)(PQContext* ctx, gpointer user_data);
+
+struct _PQContext {
+    const PQTransport* transport;
+    gpointer transport_data;
+    gboolean connected;
+    gboolean connecting;
+
+    /* Binder transport */
     GBinderServiceManager* sm;
     GBinderRemoteObject* remote;
     GBinderClient* client;
-} PQContext;
+
+    /* Asynchronous calls, issued one at a time in submission order */
+    GQueue* pending;
+    GTask* in_flight;
+    gulong in_flight_id;
+
+    /* Last value sent per setting, dropped when the HAL dies */
+    gint shadow[PQ_SETTING_MAX];
+    gboolean shadow_valid[PQ_SETTING_MAX];
+    guint cache_hits;
+    guint cache_misses;
+    gulong death_id;
+
+    /* Last value requested per setting, replayed onto a restarted HAL */
+    gint desired[PQ_SETTING_MAX];
+    gint desired_step[PQ_SETTING_MAX];
+    gboolean desired_valid[PQ_SETTING_MAX];
+    /* Last colour transform requested, replayed the same way */
+    gfloat color_transform[PQ_COLOR_MATRIX_SIZE];
+    gint color_transform_hint;
+    gint color_transform_step;
+    gboolean color_transform_valid;
+
+    /* Reconnect state while the HAL is gone */
+    gulong registration_id;
+    gulong lookup_id;
+    guint reconnect_id;
+    guint reconnect_delay_ms;
+    guint replay_pending;
+    PQReconnectFunc reconnect_func;
+    gpointer reconnect_data;
+
+    /* Running fades, see pq_transition_start() */
+    gpointer transitions;
+};
 
 /**
  * Initialize PQ HIDL interface
  *
+ * Connects right away. Setting PQ_BACKEND=fake in the environment uses
+ * the in-process fake HAL instead of the vendor service.
+ *
  * @return PQContext pointer on success, NULL on failure
  */
 PQContext *init_pq_hidl(void);
 
+/**
+ * Create a PQ context without waiting for the HAL
+ *
+ * Returns right away, the IPictureQuality service is looked up from the
+ * main loop once it is registered. Settings applied before that are kept
+ * and written when it appears, after which the reconnect callback runs.
+ *
+ * @return PQContext pointer on success, NULL if hwbinder is unavailable
+ */
+PQContext *pq_context_new(void);
+
+/**
+ * Create a PQ context for a specific backend
+ *
+ * Same as pq_context_new(), with the backend chosen by the caller
+ * instead of the PQ_BACKEND environment variable.
+ *
+ * @param backend Backend to send calls to
+ * @return PQContext pointer on success, NULL if the backend is unavailable
+ */
+PQContext *pq_context_new_for_backend(PQBackend backend);
+
+/**
+ * Configure the fake backend
+ *
+ * Defaults come from the PQ_FAKE_LATENCY_US, PQ_FAKE_FAIL_EVERY and
+ * PQ_FAKE_DIE_AFTER environment variables. A simulated death resets the
+ * fake HAL to its defaults and registers it again after a short delay.
+ *
+ * @param ctx PQContext using the fake backend
+ * @param latency_us Time every call takes
+ * @param fail_every Make every nth call return an error, 0 to disable
+ * @param die_after Simulate a HAL death after this many calls, 0 to disable
+ * @return TRUE if ctx uses the fake backend
+ */
+gboolean pq_fake_configure(PQContext* ctx,
+                           guint latency_us,
+                           guint fail_every,
+                           guint die_after);
+
 /**
  * Cleanup PQ HIDL interface and free resources
  *
@@ -92,6 +239,24 @@ PQContext *init_pq_hidl(void);
  */
 void cleanup_pq_hidl(PQContext* ctx);
 
+/**
+ * Commit GSettings writes made by libpq that are still pending
+ *
+ * Setters called from a running main loop batch their writes and commit
+ * them together shortly after. Call this before dropping the GSettings
+ * instance or exiting so the last values are not lost.
+ *
+ * @param settings GSettings instance passed to the setters
+ */
+void pq_settings_flush(GSettings *settings);
+
+/*
+ * The calls below talk to a bare GBinderClient. They bypass the context:
+ * the fake backend, the shadow cache and the state replayed onto a
+ * restarted HAL. Use pq_set_setting(), pq_get_setting() or pq_call() on
+ * a PQContext instead.
+ */
+
 /**
  * Set display color demo window parameters
  *
@@ -103,6 +268,7 @@ void cleanup_pq_hidl(PQContext* ctx);
  * @param end_y end position on y-axis (Range: 0x1 ~ 0xFFFF)
  * @return 0 if setColorRegion successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_color_region_hidl(GBinderClient* client,
                           const int split_en,
                           const int start_x,
@@ -119,6 +285,7 @@ int set_color_region_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setPQMode successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_pq_mode_hidl(GBinderClient* client,
                      const int mode,
                      const int step,
@@ -131,6 +298,7 @@ int set_pq_mode_hidl(GBinderClient* client,
  * @param tdshp_flag Flag set by tuning tool
  * @return 0 if setTDSHPFlag successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_tdshp_flag(GBinderClient* client,
                    const int tdshp_flag);
 
@@ -140,6 +308,7 @@ int set_tdshp_flag(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current TDSHP flag value, error code on failure
  */
+G_DEPRECATED_FOR(pq_call)
 int get_tdshp_flag(GBinderClient* client);
 
 /**
@@ -153,6 +322,7 @@ int get_tdshp_flag(GBinderClient* client);
  * @param step Transition speed for PQ effect change
  * @return 0 if setPQIndex successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_pq_index_hidl(GBinderClient* client,
                       const int level,
                       const int scenario,
@@ -168,6 +338,7 @@ int set_pq_index_hidl(GBinderClient* client,
  * @param step Transition speed for PQ effect change
  * @return 0 if setDISPScenario successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_disp_scenario(GBinderClient* client,
                       const int scenario,
                       const int step);
@@ -180,6 +351,7 @@ int set_disp_scenario(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_display_color_hidl(GBinderClient* client,
                                    const int mode,
                                    GSettings *settings);
@@ -192,6 +364,7 @@ int set_feature_display_color_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_content_color_hidl(GBinderClient* client,
                                    const int mode,
                                    GSettings *settings);
@@ -204,6 +377,7 @@ int set_feature_content_color_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_content_color_video_hidl(GBinderClient* client,
                                          const int mode,
                                          GSettings *settings);
@@ -216,6 +390,7 @@ int set_feature_content_color_video_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_sharpness_hidl(GBinderClient* client,
                                const int mode,
                                GSettings *settings);
@@ -228,6 +403,7 @@ int set_feature_sharpness_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_dynamic_contrast_hidl(GBinderClient* client,
                                       const int mode,
                                       GSettings *settings);
@@ -240,6 +416,7 @@ int set_feature_dynamic_contrast_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_dynamic_sharpness_hidl(GBinderClient* client,
                                        const int mode,
                                        GSettings *settings);
@@ -252,6 +429,7 @@ int set_feature_dynamic_sharpness_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_display_ccorr_hidl(GBinderClient* client,
                                    const int mode,
                                    GSettings *settings);
@@ -264,6 +442,7 @@ int set_feature_display_ccorr_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_display_gamma_hidl(GBinderClient* client,
                                    const int mode,
                                    GSettings *settings);
@@ -276,6 +455,7 @@ int set_feature_display_gamma_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_display_over_drive_hidl(GBinderClient* client,
                                         const int mode,
                                         GSettings *settings);
@@ -288,6 +468,7 @@ int set_feature_display_over_drive_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_iso_adaptive_sharpness_hidl(GBinderClient* client,
                                             const int mode,
                                             GSettings *settings);
@@ -300,6 +481,7 @@ int set_feature_iso_adaptive_sharpness_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_ultra_resolution_hidl(GBinderClient* client,
                                       const int mode,
                                       GSettings *settings);
@@ -312,6 +494,7 @@ int set_feature_ultra_resolution_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setFeatureSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_feature_video_hdr_hidl(GBinderClient* client,
                                const int mode,
                                GSettings *settings);
@@ -323,6 +506,7 @@ int set_feature_video_hdr_hidl(GBinderClient* client,
  * @param feature PQ Feature ID to query
  * @return Feature status (0: off, 1: on), error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_feature_switch(GBinderClient* client,
                        const int feature);
 
@@ -335,6 +519,7 @@ int get_feature_switch(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if enableBlueLight successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int enable_blue_light_hidl(GBinderClient* client,
                            const int enable,
                            const int step,
@@ -346,6 +531,7 @@ int enable_blue_light_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return 1 if enabled, 0 if disabled, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_blue_light_enabled_hidl(GBinderClient* client);
 
 /**
@@ -357,6 +543,7 @@ int get_blue_light_enabled_hidl(GBinderClient* client);
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setBlueLightStrength successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_blue_light_strength_hidl(GBinderClient* client,
                                  const int strength,
                                  const int step,
@@ -368,6 +555,7 @@ int set_blue_light_strength_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current strength value, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_blue_light_strength_hidl(GBinderClient* client);
 
 /**
@@ -379,6 +567,7 @@ int get_blue_light_strength_hidl(GBinderClient* client);
  * @param settings GSettings instance for persisting the setting
  * @return 0 if enableChameleon successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int enable_chameleon_hidl(GBinderClient* client,
                           const int enable,
                           const int step,
@@ -390,6 +579,7 @@ int enable_chameleon_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return 1 if enabled, 0 if disabled, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_chameleon_enabled_hidl(GBinderClient* client);
 
 /**
@@ -401,6 +591,7 @@ int get_chameleon_enabled_hidl(GBinderClient* client);
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setChameleonStrength successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_chameleon_strength_hidl(GBinderClient* client,
                                 const int strength,
                                 const int step,
@@ -412,6 +603,7 @@ int set_chameleon_strength_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current strength value, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_chameleon_strength_hidl(GBinderClient* client);
 
 /**
@@ -423,6 +615,7 @@ int get_chameleon_strength_hidl(GBinderClient* client);
  * @param value Value to set at specific address
  * @return 0 if setTuningField successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_tuning_field_hidl(GBinderClient* client,
                           const int pq_module,
                           const int field,
@@ -436,6 +629,7 @@ int set_tuning_field_hidl(GBinderClient* client,
  * @param field Offset address (based on pq_module)
  * @return Value at specified address, error code on failure
  */
+G_DEPRECATED_FOR(pq_call)
 int get_tuning_field_hidl(GBinderClient* client,
                           const int pq_module,
                           const int field);
@@ -449,6 +643,7 @@ int get_tuning_field_hidl(GBinderClient* client,
  * @param input_Y Debounced Y value of color temperature
  * @return 0 if setAmbientLightCT successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_ambient_light_ct_hidl(GBinderClient* client,
                               gdouble input_x,
                               gdouble input_y,
@@ -464,6 +659,7 @@ int set_ambient_light_ct_hidl(GBinderClient* client,
  * @param input_W Undebounced W value of ambient light
  * @return 0 if setAmbientLightRGBW successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_ambient_light_rgbw_hidl(GBinderClient* client,
                                 const int input_R,
                                 const int input_G,
@@ -479,6 +675,7 @@ int set_ambient_light_rgbw_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setGammaIndex successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_gamma_index_hidl(GBinderClient* client,
                          const int index,
                          const int step,
@@ -490,6 +687,7 @@ int set_gamma_index_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current gamma index, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_gamma_index_hidl(GBinderClient* client);
 
 /**
@@ -499,6 +697,7 @@ int get_gamma_index_hidl(GBinderClient* client);
  * @param nits Panel nits value for external display
  * @return 0 if setExternalPanelNits successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_external_panel_nits_hidl(GBinderClient* client,
                                  const int nits);
 
@@ -508,6 +707,7 @@ int set_external_panel_nits_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current panel nits value, error code on failure
  */
+G_DEPRECATED_FOR(pq_call)
 int get_external_panel_nits_hidl(GBinderClient* client);
 
 /**
@@ -520,6 +720,7 @@ int get_external_panel_nits_hidl(GBinderClient* client);
  * @param step Transition speed for effect change
  * @return 0 if setRGBGain successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_rgb_gain_hidl(GBinderClient* client,
                       const int r_gain,
                       const int g_gain,
@@ -534,6 +735,7 @@ int set_rgb_gain_hidl(GBinderClient* client,
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setGlobalPQSwitch successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_global_pq_switch_hidl(GBinderClient* client,
                               const int mode,
                               GSettings *settings);
@@ -544,6 +746,7 @@ int set_global_pq_switch_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current switch value, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_global_pq_switch_hidl(GBinderClient* client);
 
 /**
@@ -554,6 +757,7 @@ int get_global_pq_switch_hidl(GBinderClient* client);
  * @param settings GSettings instance for persisting the setting
  * @return 0 if setGlobalPQStrength successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_set_setting)
 int set_global_pq_strength_hidl(GBinderClient* client,
                                 const int strength,
                                 GSettings *settings);
@@ -564,6 +768,7 @@ int set_global_pq_strength_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current strength value, error code on failure
  */
+G_DEPRECATED_FOR(pq_get_setting)
 int get_global_pq_strength_hidl(GBinderClient* client);
 
 /**
@@ -573,6 +778,7 @@ int get_global_pq_strength_hidl(GBinderClient* client);
  * @param stable Stability status value
  * @return 0 if setGlobalPQStableStatus successfully executed, error code otherwise
  */
+G_DEPRECATED_FOR(pq_call)
 int set_global_pq_stable_status_hidl(GBinderClient* client,
                                      const int stable);
 
@@ -582,8 +788,408 @@ int set_global_pq_stable_status_hidl(GBinderClient* client,
  * @param client GBinder client instance
  * @return Current stable status value, error code on failure
  */
+G_DEPRECATED_FOR(pq_call)
 int get_global_pq_stable_status_hidl(GBinderClient* client);
 
+/**
+ * Get the io.furios.pq GSettings key backing a setting
+ *
+ * @param setting Setting ID from PQSetting enum
+ * @return GSettings key, NULL if the setting is invalid
+ */
+const char *pq_setting_key(const int setting);
+
+/**
+ * Read the value the HAL currently holds for a setting
+ *
+ * Blocks until the HAL answered, see pq_get_setting_async() for use from
+ * a main loop.
+ *
+ * @param ctx PQContext to send the call through
+ * @param setting Setting ID from PQSetting enum
+ * @param value Return location for the current value
+ * @return 0 on success, -1 if the call failed or the HAL has no getter for setting
+ */
+int pq_get_setting(PQContext* ctx,
+                   const int setting,
+                   int *value);
+
+/**
+ * Read the value the HAL holds for a setting without blocking
+ *
+ * The read is queued behind the writes already queued on the context,
+ * so it reports what they left behind.
+ *
+ * @param ctx PQContext to send the call through
+ * @param setting Setting ID from PQSetting enum
+ * @param cancellable GCancellable to abort a read that was not sent yet, may be NULL
+ * @param callback Callback to run when the read completes
+ * @param user_data Data passed to callback
+ */
+void pq_get_setting_async(PQContext* ctx,
+                          const int setting,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data);
+
+/**
+ * Finish a read started with pq_get_setting_async()
+ *
+ * @param result GAsyncResult passed to the callback
+ * @param value Return location for the current value
+ * @param error Return location for a transport error, G_IO_ERROR_NOT_SUPPORTED
+ *        if the HAL has no getter for the setting, may be NULL
+ * @return 0 on success, PQ error code or -1 with error set otherwise
+ */
+int pq_get_setting_finish(GAsyncResult *result,
+                          int *value,
+                          GError **error);
+
+/**
+ * Apply a setting and persist it
+ *
+ * The transaction is skipped when the HAL is already known to hold value.
+ * While the HAL is restarting the value is only recorded and persisted,
+ * and is written once the service is back.
+ *
+ * @param ctx PQContext to send the call through
+ * @param setting Setting ID from PQSetting enum
+ * @param value Value to apply
+ * @param step Transition speed for effect change, ignored by settings without one
+ * @param settings GSettings instance for persisting the setting, may be NULL
+ * @return 0 if the setting was applied, error code otherwise
+ */
+int pq_set_setting(PQContext* ctx,
+                   const int setting,
+                   const int value,
+                   const int step,
+                   GSettings *settings);
+
+/**
+ * Apply a setting without blocking on the HAL
+ *
+ * Calls on the same context are sent to the HAL one at a time, in the
+ * order they were made. The callback runs on the thread-default main
+ * context once the HAL replied. Calls made while the HAL is restarting
+ * stay queued until it is back.
+ *
+ * @param ctx PQContext to send the call through
+ * @param setting Setting ID from PQSetting enum
+ * @param value Value to apply
+ * @param step Transition speed for effect change, ignored by settings without one
+ * @param settings GSettings instance for persisting the setting, may be NULL
+ * @param cancellable GCancellable to abort a call that was not sent yet, may be NULL
+ * @param callback Callback to run when the call completes, may be NULL
+ * @param user_data Data passed to callback
+ */
+void pq_set_setting_async(PQContext* ctx,
+                          const int setting,
+                          const int value,
+                          const int step,
+                          GSettings *settings,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data);
+
+/**
+ * Finish a call started with pq_set_setting_async()
+ *
+ * @param result GAsyncResult passed to the callback
+ * @param error Return location for a transport error, may be NULL
+ * @return 0 if the setting was applied, PQ error code or -1 with error set otherwise
+ */
+int pq_set_setting_finish(GAsyncResult *result,
+                          GError **error);
+
+/**
+ * Easing curves for pq_transition_start()
+ */
+typedef enum {
+    PQ_EASE_LINEAR = 0,
+    PQ_EASE_IN,
+    PQ_EASE_OUT,
+    PQ_EASE_IN_OUT
+} PQEasing;
+
+/**
+ * Fade a strength to a new value over time
+ *
+ * Works for blue light strength, chameleon strength, gamma index and
+ * global PQ strength, other settings are applied right away. The fade
+ * starts from the last value applied and sends only integer changes,
+ * with the final value persisted to settings. Starting a new fade on
+ * the same setting retargets it from where it is. Applying the setting
+ * directly cancels it. Requires a running main loop.
+ *
+ * @param ctx PQContext to send the calls through
+ * @param setting Setting ID from PQSetting enum
+ * @param target Value to end on
+ * @param duration_ms Length of the fade, 0 to apply right away
+ * @param easing Easing curve
+ * @param settings GSettings instance for persisting the final value, may be NULL
+ */
+void pq_transition_start(PQContext* ctx,
+                         const int setting,
+                         const int target,
+                         const guint duration_ms,
+                         const PQEasing easing,
+                         GSettings *settings);
+
+/**
+ * Stop a fade where it is
+ *
+ * @param ctx PQContext the fade runs on
+ * @param setting Setting ID from PQSetting enum
+ */
+void pq_transition_cancel(PQContext* ctx,
+                          const int setting);
+
+/**
+ * Check whether a setting is fading
+ *
+ * @param ctx PQContext to check
+ * @param setting Setting ID from PQSetting enum
+ * @return TRUE while a fade of setting is running
+ */
+gboolean pq_transition_active(PQContext* ctx,
+                              const int setting);
+
+/**
+ * Bring the HAL in line with the values stored in GSettings
+ *
+ * Every setting is compared with what the HAL reports and only the ones
+ * that differ, or that the HAL can't report, are queued for writing.
+ * Settings already applied through the context are left alone, their
+ * stored value is older. Nothing is written back to settings. Blocks on
+ * the reads, see pq_sync_settings_async() for use from a main loop.
+ *
+ * @param ctx PQContext to send the calls through
+ * @param settings io.furios.pq GSettings instance holding the desired state
+ * @param step Transition speed for effect change
+ * @return number of settings queued for writing, -1 on invalid arguments
+ */
+int pq_sync_settings(PQContext* ctx,
+                     GSettings *settings,
+                     const int step);
+
+/**
+ * Bring the HAL in line with GSettings without blocking
+ *
+ * Same as pq_sync_settings(), with the reads queued on the context like
+ * any other call. A setting requested through the context while its read
+ * was queued keeps the requested value.
+ *
+ * @param ctx PQContext to send the calls through
+ * @param settings io.furios.pq GSettings instance holding the desired state
+ * @param step Transition speed for effect change
+ * @param cancellable GCancellable, may be NULL
+ * @param callback Callback to run once every setting was checked
+ * @param user_data Data passed to callback
+ */
+void pq_sync_settings_async(PQContext* ctx,
+                            GSettings *settings,
+                            const int step,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer user_data);
+
+/**
+ * Finish pq_sync_settings_async()
+ *
+ * @param result GAsyncResult passed to the callback
+ * @param error Return location for an error, may be NULL
+ * @return number of settings queued for writing, -1 with error set on failure
+ */
+int pq_sync_settings_finish(GAsyncResult *result,
+                            GError **error);
+
+/**
+ * Forget the values the HAL is known to hold, forcing the next write of
+ * every setting to reach the HAL
+ *
+ * @param ctx PQContext whose cache is dropped
+ */
+void pq_invalidate_cache(PQContext* ctx);
+
+/**
+ * Get the shadow cache counters of a context
+ *
+ * @param ctx PQContext to query
+ * @param hits Return location for writes skipped because the HAL already held the value
+ * @param misses Return location for writes sent to the HAL
+ */
+void pq_get_cache_stats(PQContext* ctx,
+                        guint *hits,
+                        guint *misses);
+
+/**
+ * Get the HIDL method name of a PQ function
+ *
+ * @param func Function ID from PQFunctions2_0 enum
+ * @return method name, NULL if libpq doesn't implement func
+ */
+const char *pq_function_name(const int func);
+
+/**
+ * Get the argument layout of a PQ function
+ *
+ * One character per argument: 'i' for int32 and 'b' for bool, both read
+ * from PQArg.i, 'd' for double read from PQArg.d, 'm' for a 4x4 float
+ * matrix read from PQArg.m.
+ *
+ * @param func Function ID from PQFunctions2_0 enum
+ * @return layout string, NULL if libpq doesn't implement func
+ */
+const char *pq_function_args(const int func);
+
+/**
+ * Get the reply layout of a PQ function
+ *
+ * @param func Function ID from PQFunctions2_0 enum
+ * @return "" for no value, "i" or "b" for a value, "h" for a memory handle
+ *         that only pq_ashmem_map() reads, NULL if libpq doesn't implement func
+ */
+const char *pq_function_reply(const int func);
+
+/**
+ * Call any PQ function through a context and wait for the reply
+ *
+ * Bypasses the setting cache and persistence, meant for tools and
+ * benchmarks.
+ *
+ * @param ctx PQContext to send the call through
+ * @param func Function ID from PQFunctions2_0 enum
+ * @param args Arguments as described by pq_function_args()
+ * @param out Return location for the reply value, may be NULL
+ * @return 0 on success, PQ or transaction error code, -1 if not connected or func is unknown
+ */
+int pq_call(PQContext* ctx,
+            const int func,
+            const PQArg* args,
+            gint32 *out);
+
+/**
+ * Queue any PQ function on the context's FIFO
+ *
+ * The call is sent in order with the setting writes, waits while the HAL
+ * is away and is sent again if the HAL died before answering. Matrices
+ * are copied, args only has to live until this returns.
+ *
+ * @param ctx PQContext to send the call through
+ * @param func Function ID from PQFunctions2_0 enum
+ * @param args Arguments as described by pq_function_args()
+ * @param cancellable GCancellable to abort a call that was not sent yet, may be NULL
+ * @param callback Callback to run when the call completes, may be NULL
+ * @param user_data Data passed to callback
+ */
+void pq_call_async(PQContext* ctx,
+                   const int func,
+                   const PQArg* args,
+                   GCancellable *cancellable,
+                   GAsyncReadyCallback callback,
+                   gpointer user_data);
+
+/**
+ * Finish a call started with pq_call_async()
+ *
+ * @param result GAsyncResult passed to the callback
+ * @param out Return location for the reply value, may be NULL
+ * @param error Return location for a transport error, may be NULL
+ * @return 0 on success, PQ error code or -1 with error set otherwise
+ */
+int pq_call_finish(GAsyncResult *result,
+                   gint32 *out,
+                   GError **error);
+
+/**
+ * Upload a colour transform to the display pipeline
+ *
+ * The matrix is applied to each pixel as (R, G, B, 1) multiplied by its
+ * rows, so the fourth column holds offsets. See pq-color.h to combine
+ * several effects into one transform. The context keeps the last matrix
+ * and uploads it again once a restarted HAL is back, before the
+ * reconnect callback runs.
+ *
+ * @param ctx PQContext to send the call through
+ * @param matrix PQ_COLOR_MATRIX_SIZE floats, row-major
+ * @param hint Android ColorTransform hint, 0 for identity, 1 for an arbitrary matrix
+ * @param step Transition step count
+ * @return 0 on success, PQ or transaction error code, -1 if not connected
+ */
+int pq_set_color_transform(PQContext* ctx,
+                           const gfloat *matrix,
+                           const int hint,
+                           const int step);
+
+/* Latency histogram buckets, bucket i counts calls taking [2^i, 2^(i+1)) ns */
+#define PQ_STATS_BUCKETS 32
+
+/**
+ * Call counters of one PQ function, shared by every context in the process
+ */
+typedef struct {
+    guint64 calls;
+    /* Transactions that failed before the HAL answered */
+    guint64 failures;
+    /* Calls the HAL answered with a non-zero retval */
+    guint64 hal_errors;
+    guint64 total_ns;
+    guint64 max_ns;
+    guint64 histogram[PQ_STATS_BUCKETS];
+} PQFunctionStats;
+
+/**
+ * Read the counters of a PQ function
+ *
+ * Safe to call from any thread. Counters are read one by one, so a
+ * snapshot taken while calls are running may be off by the calls in
+ * progress.
+ *
+ * @param func Function ID from PQFunctions2_0 enum
+ * @param stats Return location for the counters, zeroed for unknown functions
+ */
+void pq_stats_get(const int func,
+                  PQFunctionStats *stats);
+
+/**
+ * Reset the counters of every PQ function
+ */
+void pq_stats_reset(void);
+
+/**
+ * Export the counters as the io.FuriOS.PQ.Stats interface
+ *
+ * GetStats() returns a{s(tttttat)} mapping each HIDL method that was
+ * called to (calls, failures, hal_errors, total_ns, max_ns, histogram),
+ * Reset() clears the counters.
+ *
+ * @param connection Connection to export on
+ * @param object_path Object path to export at
+ * @param error Return location for an error, may be NULL
+ * @return registration ID for g_dbus_connection_unregister_object(), 0 on failure
+ */
+guint pq_stats_export(GDBusConnection *connection,
+                      const gchar *object_path,
+                      GError **error);
+
+/**
+ * Register a callback for HAL restarts
+ *
+ * When the IPictureQuality service dies the context drops its client and
+ * waits for the service to be registered again. Settings changed in the
+ * meantime are kept as desired state. After reconnecting, every desired
+ * value the new instance doesn't already report is written again, then
+ * func is called. It also runs when a context from pq_context_new()
+ * connects for the first time.
+ *
+ * @param ctx PQContext to watch
+ * @param func Callback, NULL to remove it
+ * @param user_data Data passed to func
+ */
+void pq_set_reconnect_func(PQContext* ctx,
+                           PQReconnectFunc func,
+                           gpointer user_data);
+
 /**
  * Run a PQ HIDL command
  *
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#include "pq.h"
+#include <gio/gio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_WARMUP 50
+#define CONNECT_TIMEOUT_MS 5000
+
+/*
+ * Count allocations made while a call is measured. glibc resolves
+ * malloc to the executable first, so these wrap every allocation libpq,
+ * GLib and libgbinder make in this process, aligned ones included.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static gint counting;
+static guint64 allocations;
+
+static inline void count_allocation(void) {
+    if (g_atomic_int_get(&counting))
+        __atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+}
+
+void *malloc(size_t size) {
+    count_allocation();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    count_allocation();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    count_allocation();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    count_allocation();
+    return __libc_memalign(alignment, size);
+}
+
+/* g_aligned_alloc() ends up here */
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    void *ptr;
+
+    if (!alignment || alignment % sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+
+    count_allocation();
+    ptr = __libc_memalign(alignment, size);
+    if (!ptr && size)
+        return ENOMEM;
+
+    *memptr = ptr;
+    return 0;
+}
+
+typedef struct {
+    int func;
+    PQArg args[PQ_MAX_ARGS];
+    guint failures;
+    guint64 allocations;
+    guint64 total_ns;
+    guint64 *samples;
+} BenchResult;
+
+static guint64 now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64)ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+static int compare_samples(const void *a, const void *b) {
+    guint64 x = *(const guint64 *)a;
+    guint64 y = *(const guint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static guint64 percentile(const guint64 *sorted, guint n, guint p) {
+    guint index = (guint)(((guint64)n * p + 99) / 100);
+
+    return sorted[index ? index - 1 : 0];
+}
+
+static bool is_getter(int func) {
+    const char *reply = pq_function_reply(func);
+
+    return reply && reply[0];
+}
+
+/*
+ * In PQFunctions2_0 a getter directly follows its setter and takes the
+ * same leading arguments, the value comes right after them. Setters are
+ * benchmarked by writing back what the getter reports, so running this
+ * on a device doesn't change the picture.
+ */
+static bool prepare_args(PQContext *ctx, int func, PQArg *args, bool all) {
+    static const gfloat identity[PQ_COLOR_MATRIX_SIZE] = {
+        1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1,
+    };
+    const char *layout = pq_function_args(func);
+    int getter = func + 1;
+    gint32 value = 0;
+    gsize index;
+
+    memset(args, 0, sizeof(PQArg) * PQ_MAX_ARGS);
+    for (gsize i = 0; layout[i]; i++) {
+        if (layout[i] == 'd')
+            args[i].d = 0.5;
+        else if (layout[i] == 'm')
+            args[i].m = identity;
+    }
+
+    if (is_getter(func))
+        return true;
+
+    if (!pq_function_name(getter) || !is_getter(getter))
+        return all;
+
+    index = strlen(pq_function_args(getter));
+    if (pq_call(ctx, getter, args, &value) != 0)
+        return all;
+
+    args[index].i = value;
+    return true;
+}
+
+static void run_function(PQContext *ctx, BenchResult *result, guint iterations, guint warmup) {
+    gint32 out;
+
+    for (guint i = 0; i < warmup; i++)
+        pq_call(ctx, result->func, result->args, &out);
+
+    for (guint i = 0; i < iterations; i++) {
+        guint64 start, end;
+        int ret;
+
+        __atomic_store_n(&allocations, 0, __ATOMIC_RELAXED);
+        g_atomic_int_set(&counting, 1);
+        start = now_ns();
+        ret = pq_call(ctx, result->func, result->args, &out);
+        end = now_ns();
+        g_atomic_int_set(&counting, 0);
+
+        result->allocations += __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+        result->samples[i] = end - start;
+        result->total_ns += end - start;
+        if (ret != 0)
+            result->failures++;
+    }
+
+    qsort(result->samples, iterations, sizeof(guint64), compare_samples);
+}
+
+static void print_result(const BenchResult *result, guint iterations, bool last) {
+    double seconds = result->total_ns / 1e9;
+
+    printf("    {\"function\": \"%s\", \"calls\": %u, \"failures\": %u, "
+           "\"p50_ns\": %" G_GUINT64_FORMAT ", \"p95_ns\": %" G_GUINT64_FORMAT ", "
+           "\"p99_ns\": %" G_GUINT64_FORMAT ", \"mean_ns\": %" G_GUINT64_FORMAT ", "
+           "\"calls_per_sec\": %.1f, \"allocs_per_call\": %.2f}%s\n",
+           pq_function_name(result->func), iterations, result->failures,
+           percentile(result->samples, iterations, 50),
+           percentile(result->samples, iterations, 95),
+           percentile(result->samples, iterations, 99),
+           result->total_ns / iterations,
+           seconds > 0 ? iterations / seconds : 0.0,
+           (double)result->allocations / iterations,
+           last ? "" : ",");
+}
+
+static void on_connected(PQContext *ctx, gpointer user_data) {
+    g_main_loop_quit(user_data);
+}
+
+static gboolean on_connect_timeout(gpointer user_data) {
+    g_main_loop_quit(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+static PQContext *connect_backend(PQBackend backend) {
+    PQContext *ctx = pq_context_new_for_backend(backend);
+    GMainLoop *loop;
+    guint timeout_id;
+
+    if (!ctx)
+        return NULL;
+
+    loop = g_main_loop_new(NULL, FALSE);
+    pq_set_reconnect_func(ctx, on_connected, loop);
+    timeout_id = g_timeout_add(CONNECT_TIMEOUT_MS, on_connect_timeout, loop);
+    g_main_loop_run(loop);
+
+    if (ctx->connected)
+        g_source_remove(timeout_id);
+    pq_set_reconnect_func(ctx, NULL, NULL);
+    g_main_loop_unref(loop);
+
+    if (!ctx->connected) {
+        cleanup_pq_hidl(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [options]\n", name);
+    fprintf(stderr, "  --backend binder|fake  Backend to benchmark (default: PQ_BACKEND or binder)\n");
+    fprintf(stderr, "  --iterations N         Measured calls per function (default: %d)\n", DEFAULT_ITERATIONS);
+    fprintf(stderr, "  --warmup N             Unmeasured calls per function (default: %d)\n", DEFAULT_WARMUP);
+    fprintf(stderr, "  --function NAME        Only benchmark this HIDL method, e.g. setBlueLightStrength\n");
+    fprintf(stderr, "  --latency-us N         Latency of every fake backend call\n");
+    fprintf(stderr, "  --all                  Also run setters that have no getter to restore from\n");
+    fprintf(stderr, "Results are printed as JSON on stdout.\n");
+}
+
+int main(int argc, char *argv[]) {
+    PQBackend backend = PQ_BACKEND_DEFAULT;
+    guint iterations = DEFAULT_ITERATIONS;
+    guint warmup = DEFAULT_WARMUP;
+    guint latency_us = 0;
+    const char *only = NULL;
+    bool all = false;
+    bool fake;
+    GArray *results;
+    PQContext *ctx;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "--all") == 0) {
+            all = true;
+            continue;
+        }
+
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (strcmp(arg, "--backend") == 0) {
+            if (strcmp(value, "fake") == 0) {
+                backend = PQ_BACKEND_FAKE;
+            } else if (strcmp(value, "binder") == 0) {
+                backend = PQ_BACKEND_BINDER;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(arg, "--iterations") == 0) {
+            iterations = atoi(value);
+        } else if (strcmp(arg, "--warmup") == 0) {
+            warmup = atoi(value);
+        } else if (strcmp(arg, "--function") == 0) {
+            only = value;
+        } else if (strcmp(arg, "--latency-us") == 0) {
+            latency_us = atoi(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+    }
+
+    if (iterations == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ctx = connect_backend(backend);
+    if (!ctx) {
+        fprintf(stderr, "Failed to connect to the PQ backend\n");
+        return 1;
+    }
+
+    /* The stand-in can't damage anything, run every function on it */
+    fake = pq_fake_configure(ctx, latency_us, 0, 0);
+    if (fake)
+        all = true;
+
+    results = g_array_new(FALSE, TRUE, sizeof(BenchResult));
+    for (int func = 1; func < PQ_FUNCTION_MAX; func++) {
+        BenchResult result = { .func = func };
+
+        if (!pq_function_name(func))
+            continue;
+        if (only && strcmp(only, pq_function_name(func)) != 0)
+            continue;
+        /* No getter to restore it from, and --all would still wipe the active transform */
+        if (func == SET_COLOR_TRANSFORM && !fake) {
+            fprintf(stderr, "Skipping %s, it would replace the active colour transform\n", pq_function_name(func));
+            continue;
+        }
+        if (!prepare_args(ctx, func, result.args, all)) {
+            fprintf(stderr, "Skipping %s, nothing to restore it from (use --all)\n", pq_function_name(func));
+            continue;
+        }
+
+        result.samples = g_new0(guint64, iterations);
+        run_function(ctx, &result, iterations, warmup);
+        g_array_append_val(results, result);
+    }
+
+    printf("{\n");
+    printf("  \"backend\": \"%s\",\n", fake ? "fake" : "binder");
+    printf("  \"iterations\": %u,\n", iterations);
+    printf("  \"warmup\": %u,\n", warmup);
+    printf("  \"results\": [\n");
+    for (guint i = 0; i < results->len; i++) {
+        BenchResult *result = &g_array_index(results, BenchResult, i);
+
+        print_result(result, iterations, i + 1 == results->len);
+        g_free(result->samples);
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    g_array_free(results, TRUE);
+    cleanup_pq_hidl(ctx);
+    return 0;
+}
@@ -5,17 +5,292 @@
  */
 
 #include "pq.h"
+#include <gio/gio.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+
+/* A connected HAL answers in milliseconds, anything slower is queued */
+#define PQ_DBUS_TIMEOUT_MS 5000
+
+/* io.FuriOS.PQ methods, indexed by function id */
+static const char *dbus_methods[] = {
+    NULL,
+    "SetPQMode",
+    "EnableBlueLight",
+    "SetBlueLightStrength",
+    "EnableChameleon",
+    "SetChameleonStrength",
+    "SetGammaIndex",
+    "SetFeatureDisplayColor",
+    "SetFeatureContentColor",
+    "SetFeatureContentColorVideo",
+    "SetFeatureSharpness",
+    "SetFeatureDynamicContrast",
+    "SetFeatureDynamicSharpness",
+    "SetFeatureDisplayCCorr",
+    "SetFeatureDisplayGamma",
+    "SetFeatureDisplayOverDrive",
+    "SetFeatureISOAdaptiveSharpness",
+    "SetFeatureUltraResolution",
+    "SetFeatureVideoHDR",
+    "SetGlobalPQSwitch",
+    "SetGlobalPQStrength",
+};
 
 bool is_func_valid(int func) {
     return func >= 1 && func <= 20;
 }
 
+/*
+ * Forward the call to a running pqdbus, which already holds a HAL
+ * connection. Returns 0 on success or if the service queued the call
+ * for a HAL that is away, 1 if the service is not running, -1 if the
+ * service failed the call.
+ */
+static int run_pq_dbus(int func, int input) {
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    GVariant *result;
+
+    if (!connection) {
+        g_error_free(error);
+        return 1;
+    }
+
+    result = g_dbus_connection_call_sync(connection,
+                                         "io.FuriOS.PQ",
+                                         "/io/FuriOS/PQ",
+                                         "io.FuriOS.PQ",
+                                         dbus_methods[func],
+                                         g_variant_new("(i)", input),
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                         PQ_DBUS_TIMEOUT_MS,
+                                         NULL,
+                                         &error);
+    g_object_unref(connection);
+
+    /* pqdbus stored the value and sends it once the HAL is back */
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_PENDING) ||
+        g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT) ||
+        g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY)) {
+        printf("io.FuriOS.PQ queued the request: %s\n", error->message);
+        g_error_free(error);
+        return 0;
+    }
+
+    if (!result) {
+        bool missing = g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+                       g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER);
+
+        if (!missing)
+            printf("io.FuriOS.PQ failed: %s\n", error->message);
+        g_error_free(error);
+        return missing ? 1 : -1;
+    }
+
+    g_variant_unref(result);
+    return 0;
+}
+
+typedef struct Batch Batch;
+
+typedef struct {
+    Batch *batch;
+    int line;
+    int func;
+    int input;
+    bool barrier;
+    int status;
+    char *error;
+    gint64 start;
+    gint64 end;
+} BatchCommand;
+
+struct Batch {
+    PQContext *ctx;
+    GSettings *settings;
+    GMainLoop *loop;
+    GArray *commands;
+    guint next;
+    guint outstanding;
+};
+
+/*
+ * Parse one line of a batch script. Commands are "function_id input"
+ * pairs, several can share a line separated by ';', "barrier" waits for
+ * every earlier command to complete and '#' starts a comment.
+ */
+static bool parse_batch_line(char *text, int line, GArray *commands) {
+    char *comment = strchr(text, '#');
+    char **parts;
+    bool ok = true;
+
+    if (comment)
+        *comment = '\0';
+
+    parts = g_strsplit(text, ";", -1);
+    for (int i = 0; parts[i] && ok; i++) {
+        char *part = g_strstrip(parts[i]);
+        BatchCommand cmd = { 0 };
+        char extra;
+
+        if (*part == '\0')
+            continue;
+
+        cmd.line = line;
+        if (strcmp(part, "barrier") == 0) {
+            cmd.barrier = true;
+        } else if (sscanf(part, "%d %d %c", &cmd.func, &cmd.input, &extra) != 2 ||
+                   !is_func_valid(cmd.func)) {
+            fprintf(stderr, "line %d: invalid command '%s'\n", line, part);
+            ok = false;
+            break;
+        }
+
+        g_array_append_val(commands, cmd);
+    }
+
+    g_strfreev(parts);
+    return ok;
+}
+
+static void batch_submit(Batch *batch);
+
+static void on_batch_command_done(GObject *source, GAsyncResult *result, gpointer user_data) {
+    BatchCommand *cmd = user_data;
+    GError *error = NULL;
+
+    cmd->end = g_get_monotonic_time();
+    cmd->status = pq_set_setting_finish(result, &error);
+    if (error) {
+        cmd->error = g_strdup(error->message);
+        g_error_free(error);
+    }
+
+    cmd->batch->outstanding--;
+    batch_submit(cmd->batch);
+}
+
+static void batch_submit(Batch *batch) {
+    while (batch->next < batch->commands->len) {
+        BatchCommand *cmd = &g_array_index(batch->commands, BatchCommand, batch->next);
+
+        if (cmd->barrier) {
+            if (batch->outstanding > 0)
+                return;
+            batch->next++;
+            continue;
+        }
+
+        batch->next++;
+        batch->outstanding++;
+        cmd->start = g_get_monotonic_time();
+        pq_set_setting_async(batch->ctx, cmd->func, cmd->input, 5 /* step */,
+                             batch->settings, NULL, on_batch_command_done, cmd);
+    }
+
+    if (batch->outstanding == 0)
+        g_main_loop_quit(batch->loop);
+}
+
+static int print_batch_summary(Batch *batch, gint64 elapsed) {
+    int failed = 0, total = 0;
+
+    printf("%-4s %-6s %-4s %-8s %-8s %s\n", "#", "line", "id", "input", "status", "time");
+    for (guint i = 0; i < batch->commands->len; i++) {
+        BatchCommand *cmd = &g_array_index(batch->commands, BatchCommand, i);
+
+        if (cmd->barrier)
+            continue;
+
+        total++;
+        if (cmd->status != 0)
+            failed++;
+
+        printf("%-4d %-6d %-4d %-8d %-8d %.3f ms%s%s\n", total, cmd->line, cmd->func, cmd->input,
+               cmd->status, (cmd->end - cmd->start) / 1000.0,
+               cmd->error ? " " : "", cmd->error ? cmd->error : "");
+    }
+
+    printf("%d commands, %d failed, %.3f ms total\n", total, failed, elapsed / 1000.0);
+    return failed ? 1 : 0;
+}
+
+static int run_batch(const char *path) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    Batch batch = { 0 };
+    char *text = NULL;
+    size_t size = 0;
+    int line = 0, ret;
+    bool ok = true;
+    gint64 start;
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    batch.commands = g_array_new(FALSE, TRUE, sizeof(BatchCommand));
+    while (ok && getline(&text, &size, file) >= 0)
+        ok = parse_batch_line(text, ++line, batch.commands);
+    free(text);
+    if (file != stdin)
+        fclose(file);
+
+    if (!ok) {
+        g_array_free(batch.commands, TRUE);
+        return 1;
+    }
+
+    batch.ctx = init_pq_hidl();
+    if (!batch.ctx) {
+        printf("None of the backends are available for PQ. Exiting.\n");
+        g_array_free(batch.commands, TRUE);
+        return 1;
+    }
+
+    GSettingsSchemaSource *schema_source = g_settings_schema_source_get_default();
+    GSettingsSchema *schema = g_settings_schema_source_lookup(schema_source, "io.furios.pq", TRUE);
+    batch.settings = schema ? g_settings_new("io.furios.pq") : NULL;
+    batch.loop = g_main_loop_new(NULL, FALSE);
+
+    for (guint i = 0; i < batch.commands->len; i++)
+        g_array_index(batch.commands, BatchCommand, i).batch = &batch;
+
+    start = g_get_monotonic_time();
+    batch_submit(&batch);
+    if (batch.outstanding > 0 || batch.next < batch.commands->len)
+        g_main_loop_run(batch.loop);
+
+    ret = print_batch_summary(&batch, g_get_monotonic_time() - start);
+
+    for (guint i = 0; i < batch.commands->len; i++)
+        g_free(g_array_index(batch.commands, BatchCommand, i).error);
+    g_array_free(batch.commands, TRUE);
+    g_main_loop_unref(batch.loop);
+    if (batch.settings) {
+        pq_settings_flush(batch.settings);
+        g_object_unref(batch.settings);
+    }
+    if (schema)
+        g_settings_schema_unref(schema);
+    cleanup_pq_hidl(batch.ctx);
+
+    return ret;
+}
+
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && argc <= 3 && strcmp(argv[1], "--batch") == 0)
+        return run_batch(argc == 3 ? argv[2] : "-");
+
     if (argc != 3) {
         printf("Usage: %s function_id input\n"
+               "       %s --batch [file|-]\n"
+               "Batch scripts hold one 'function_id input' per line or several separated by ';',\n"
+               "'barrier' waits for every earlier command and '#' starts a comment.\n"
                "id 1: setPQMode, inputs: <0: standard mode, 1: vivid mode>\n"
                "id 2: enableBlueLight, inputs: <0: disable, 1: enable>\n"
                "id 3: setBlueLightStrength, inputs: <0-1000>\n"
@@ -35,7 +310,7 @@ int main(int argc, char *argv[]) {
                "id 17: setFeatureUltraResolution, inputs: <0: disable, 1: enable>\n"
                "id 18: setFeatureVideoHdr, inputs: <0: disable, 1: enable>\n"
                "id 19: setGlobalPQSwitch, inputs: <0: disable, 1: enable>\n"
-               "id 20: setGlobalPQStrength, inputs: <0-1000>\n", argv[0]);
+               "id 20: setGlobalPQStrength, inputs: <0-1000>\n", argv[0], argv[0]);
         return 1;
     }
 
@@ -43,7 +318,16 @@ int main(int argc, char *argv[]) {
     int input = atoi(argv[2]);
 
     if (is_func_valid(func)) {
-        int ret = run_pq_hidl(func, input);
+        int ret = run_pq_dbus(func, input);
+
+        if (ret == 0) {
+            printf("Using D-Bus backend\n");
+            return 0;
+        } else if (ret < 0) {
+            return 1;
+        }
+
+        ret = run_pq_hidl(func, input);
 
         if (ret != 0) {
            printf("None of the backends are available for PQ. Exiting.\n");
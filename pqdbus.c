@@ -5,9 +5,12 @@
  */
 
 #include <gio/gio.h>
+#include <glib-unix.h>
 #include "pq.h"
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static const gchar introspection_xml[] =
     "<node>"
@@ -66,12 +69,44 @@ static const gchar introspection_xml[] =
     "    <method name='SetFeatureVideoHDR'>"
     "      <arg type='i' name='mode' direction='in'/>"
     "    </method>"
+    "    <method name='SetGlobalPQSwitch'>"
+    "      <arg type='i' name='mode' direction='in'/>"
+    "    </method>"
+    "    <method name='SetGlobalPQStrength'>"
+    "      <arg type='i' name='mode' direction='in'/>"
+    "    </method>"
+    "    <method name='ApplySettings'>"
+    "      <arg type='a{sv}' name='settings' direction='in'/>"
+    "      <arg type='a{si}' name='results' direction='out'/>"
+    "    </method>"
+    "    <property name='PQMode' type='i' access='read'/>"
+    "    <property name='BlueLight' type='i' access='read'/>"
+    "    <property name='BlueLightStrength' type='i' access='read'/>"
+    "    <property name='Chameleon' type='i' access='read'/>"
+    "    <property name='ChameleonStrength' type='i' access='read'/>"
+    "    <property name='GammaIndex' type='i' access='read'/>"
+    "    <property name='FeatureDisplayColor' type='i' access='read'/>"
+    "    <property name='FeatureContentColor' type='i' access='read'/>"
+    "    <property name='FeatureContentColorVideo' type='i' access='read'/>"
+    "    <property name='FeatureSharpness' type='i' access='read'/>"
+    "    <property name='FeatureDynamicContrast' type='i' access='read'/>"
+    "    <property name='FeatureDynamicSharpness' type='i' access='read'/>"
+    "    <property name='FeatureDisplayCCorr' type='i' access='read'/>"
+    "    <property name='FeatureDisplayGamma' type='i' access='read'/>"
+    "    <property name='FeatureDisplayOverDrive' type='i' access='read'/>"
+    "    <property name='FeatureISOAdaptiveSharpness' type='i' access='read'/>"
+    "    <property name='FeatureUltraResolution' type='i' access='read'/>"
+    "    <property name='FeatureVideoHDR' type='i' access='read'/>"
+    "    <property name='GlobalPQSwitch' type='i' access='read'/>"
+    "    <property name='GlobalPQStrength' type='i' access='read'/>"
     "  </interface>"
     "</node>";
 
 typedef struct {
     PQContext *pq_ctx;
     GSettings *settings;
+    GDBusConnection *connection;
+    gint values[PQ_SETTING_MAX];
 } ServiceContext;
 
 static void
@@ -81,8 +116,11 @@ cleanup_service_context(ServiceContext *ctx)
         return;
     if (ctx->pq_ctx)
         cleanup_pq_hidl(ctx->pq_ctx);
-    if (ctx->settings)
+    if (ctx->settings) {
+        g_signal_handlers_disconnect_by_data(ctx->settings, ctx);
+        pq_settings_flush(ctx->settings);
         g_object_unref(ctx->settings);
+    }
     free(ctx);
 }
 
@@ -95,8 +133,10 @@ init_service_context(void)
 
     ctx->pq_ctx = NULL;
     ctx->settings = NULL;
+    ctx->connection = NULL;
+    memset(ctx->values, 0, sizeof(ctx->values));
 
-    ctx->pq_ctx = init_pq_hidl();
+    ctx->pq_ctx = pq_context_new();
     if (!ctx->pq_ctx) {
         cleanup_service_context(ctx);
         return NULL;
@@ -114,6 +154,432 @@ init_service_context(void)
     return ctx;
 }
 
+static const struct {
+    const gchar *method;
+    const gchar *property;
+    int setting;
+} pq_methods[] = {
+    { "SetPQMode", "PQMode", PQ_SETTING_PQ_MODE },
+    { "EnableBlueLight", "BlueLight", PQ_SETTING_BLUE_LIGHT },
+    { "SetBlueLightStrength", "BlueLightStrength", PQ_SETTING_BLUE_LIGHT_STRENGTH },
+    { "EnableChameleon", "Chameleon", PQ_SETTING_CHAMELEON },
+    { "SetChameleonStrength", "ChameleonStrength", PQ_SETTING_CHAMELEON_STRENGTH },
+    { "SetGammaIndex", "GammaIndex", PQ_SETTING_GAMMA_INDEX },
+    { "SetFeatureDisplayColor", "FeatureDisplayColor", PQ_SETTING_DISPLAY_COLOR },
+    { "SetFeatureContentColor", "FeatureContentColor", PQ_SETTING_CONTENT_COLOR },
+    { "SetFeatureContentColorVideo", "FeatureContentColorVideo", PQ_SETTING_CONTENT_COLOR_VIDEO },
+    { "SetFeatureSharpness", "FeatureSharpness", PQ_SETTING_SHARPNESS },
+    { "SetFeatureDynamicContrast", "FeatureDynamicContrast", PQ_SETTING_DYNAMIC_CONTRAST },
+    { "SetFeatureDynamicSharpness", "FeatureDynamicSharpness", PQ_SETTING_DYNAMIC_SHARPNESS },
+    { "SetFeatureDisplayCCorr", "FeatureDisplayCCorr", PQ_SETTING_DISPLAY_CCORR },
+    { "SetFeatureDisplayGamma", "FeatureDisplayGamma", PQ_SETTING_DISPLAY_GAMMA },
+    { "SetFeatureDisplayOverDrive", "FeatureDisplayOverDrive", PQ_SETTING_DISPLAY_OVER_DRIVE },
+    { "SetFeatureISOAdaptiveSharpness", "FeatureISOAdaptiveSharpness", PQ_SETTING_ISO_ADAPTIVE_SHARPNESS },
+    { "SetFeatureUltraResolution", "FeatureUltraResolution", PQ_SETTING_ULTRA_RESOLUTION },
+    { "SetFeatureVideoHDR", "FeatureVideoHDR", PQ_SETTING_VIDEO_HDR },
+    { "SetGlobalPQSwitch", "GlobalPQSwitch", PQ_SETTING_GLOBAL_PQ_SWITCH },
+    { "SetGlobalPQStrength", "GlobalPQStrength", PQ_SETTING_GLOBAL_PQ_STRENGTH },
+};
+
+/*
+ * Property values are served from ctx->values, the HAL is only queried
+ * to fill it. Writes that went through update it, as do changes other
+ * processes store in settings, so a property read never turns into a
+ * binder transaction.
+ */
+static void
+emit_properties_changed(ServiceContext *ctx,
+                        GVariantBuilder *changed)
+{
+    GError *error = NULL;
+
+    if (!ctx->connection) {
+        g_variant_builder_clear(changed);
+        return;
+    }
+
+    g_dbus_connection_emit_signal(ctx->connection,
+                                  NULL,
+                                  "/io/FuriOS/PQ",
+                                  "org.freedesktop.DBus.Properties",
+                                  "PropertiesChanged",
+                                  g_variant_new("(sa{sv}as)",
+                                                "io.FuriOS.PQ",
+                                                changed,
+                                                NULL),
+                                  &error);
+    if (error) {
+        g_printerr("Error emitting PropertiesChanged: %s\n", error->message);
+        g_error_free(error);
+    }
+}
+
+static gboolean
+cache_property(ServiceContext *ctx,
+               gsize index,
+               gint value,
+               GVariantBuilder *changed)
+{
+    int setting = pq_methods[index].setting;
+
+    if (ctx->values[setting] == value)
+        return FALSE;
+
+    ctx->values[setting] = value;
+    g_variant_builder_add(changed, "{sv}", pq_methods[index].property,
+                          g_variant_new_int32(value));
+    return TRUE;
+}
+
+static void
+update_property(ServiceContext *ctx,
+                gsize index,
+                gint value)
+{
+    GVariantBuilder changed;
+
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    if (cache_property(ctx, index, value, &changed))
+        emit_properties_changed(ctx, &changed);
+    else
+        g_variant_builder_clear(&changed);
+}
+
+/*
+ * Re-read every value from the HAL, falling back to the stored setting
+ * for values the HAL has no getter for (PQ mode) or fails to report.
+ * Used at startup and whenever the HAL may have lost its state. The
+ * reads are queued on the context, PropertiesChanged is emitted once
+ * the last one answered.
+ */
+typedef struct {
+    ServiceContext *ctx;
+    GVariantBuilder changed;
+    gboolean any_changed;
+    gboolean cancelled;
+    gsize outstanding;
+} RefreshBatch;
+
+typedef struct {
+    RefreshBatch *batch;
+    gsize index;
+} RefreshRequest;
+
+static void
+finish_refresh_batch(RefreshBatch *batch)
+{
+    if (!batch->cancelled && batch->any_changed)
+        emit_properties_changed(batch->ctx, &batch->changed);
+    else
+        g_variant_builder_clear(&batch->changed);
+
+    g_free(batch);
+}
+
+static void
+on_property_read(GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+    RefreshRequest *request = user_data;
+    RefreshBatch *batch = request->batch;
+    ServiceContext *ctx = batch->ctx;
+    int setting = pq_methods[request->index].setting;
+    GError *error = NULL;
+    int value = 0;
+    int ret = pq_get_setting_finish(result, &value, &error);
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* Shutting down, the service context is going away */
+        batch->cancelled = TRUE;
+    } else {
+        if (ret != 0)
+            value = g_settings_get_int(ctx->settings, pq_setting_key(setting));
+
+        batch->any_changed |= cache_property(ctx, request->index, value, &batch->changed);
+    }
+
+    g_clear_error(&error);
+    g_free(request);
+
+    if (--batch->outstanding == 0)
+        finish_refresh_batch(batch);
+}
+
+static void
+refresh_property_cache(ServiceContext *ctx)
+{
+    RefreshBatch *batch;
+
+    /* Reads would wait for the HAL, serve the stored values meanwhile */
+    if (!ctx->pq_ctx->connected) {
+        for (gsize i = 0; i < G_N_ELEMENTS(pq_methods); i++)
+            update_property(ctx, i, g_settings_get_int(ctx->settings,
+                                                       pq_setting_key(pq_methods[i].setting)));
+        return;
+    }
+
+    batch = g_new0(RefreshBatch, 1);
+    batch->ctx = ctx;
+    batch->outstanding = G_N_ELEMENTS(pq_methods);
+    g_variant_builder_init(&batch->changed, G_VARIANT_TYPE("a{sv}"));
+
+    for (gsize i = 0; i < G_N_ELEMENTS(pq_methods); i++) {
+        RefreshRequest *request = g_new0(RefreshRequest, 1);
+        request->batch = batch;
+        request->index = i;
+
+        pq_get_setting_async(ctx->pq_ctx, pq_methods[i].setting, NULL, on_property_read, request);
+    }
+}
+
+static void
+on_pq_reconnected(PQContext *pq_ctx,
+                  gpointer user_data)
+{
+    /* The restarted HAL now holds the replayed state */
+    refresh_property_cache(user_data);
+}
+
+/* Other writers of io.furios.pq, gsd-adapter mostly, apply what they store */
+static void
+on_settings_changed(GSettings *settings,
+                    const gchar *key,
+                    gpointer user_data)
+{
+    ServiceContext *ctx = user_data;
+
+    for (gsize i = 0; i < G_N_ELEMENTS(pq_methods); i++) {
+        if (g_strcmp0(key, pq_setting_key(pq_methods[i].setting)) == 0) {
+            update_property(ctx, i, g_settings_get_int(settings, key));
+            return;
+        }
+    }
+}
+
+typedef struct {
+    ServiceContext *ctx;
+    GDBusMethodInvocation *invocation;
+    gsize index;
+    gint value;
+} SetRequest;
+
+static void
+on_setting_applied(GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    SetRequest *request = user_data;
+    GDBusMethodInvocation *invocation = request->invocation;
+    GError *error = NULL;
+    int ret = pq_set_setting_finish(result, &error);
+
+    if (error) {
+        /* Nobody waits for a write that was queued while the HAL was away */
+        if (invocation)
+            g_dbus_method_invocation_return_gerror(invocation, error);
+        g_error_free(error);
+        g_free(request);
+        return;
+    }
+
+    if (ret != 0)
+        g_debug("%s failed with %d", pq_methods[request->index].method, ret);
+    else
+        update_property(request->ctx, request->index, request->value);
+
+    /* Already answered if the write had to wait for the HAL */
+    if (invocation)
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    g_free(request);
+}
+
+/*
+ * Writes wait in the queue while the HAL is away, possibly for good.
+ * The caller is told right away instead of hanging on the reply, the
+ * value is stored and sent once the HAL is back.
+ */
+static gboolean
+return_if_queued(ServiceContext *ctx,
+                 GDBusMethodInvocation *invocation)
+{
+    if (ctx->pq_ctx->connected)
+        return FALSE;
+
+    g_dbus_method_invocation_return_error(invocation, G_IO_ERROR, G_IO_ERROR_PENDING,
+                                          "PQ service not available, queued until it is back");
+    return TRUE;
+}
+
+/*
+ * ApplySettings: a whole profile in one call. Entries are validated
+ * before anything is sent, then queued in setting order on the context's
+ * FIFO so the HAL sees them back-to-back. Persistence is flushed and
+ * PropertiesChanged emitted once, when the last write has answered.
+ */
+typedef struct {
+    gsize index;
+    gint value;
+    gint result;
+} ApplyEntry;
+
+typedef struct {
+    ServiceContext *ctx;
+    GDBusMethodInvocation *invocation;
+    ApplyEntry *entries;
+    gsize n_entries;
+    gsize outstanding;
+} ApplyBatch;
+
+typedef struct {
+    ApplyBatch *batch;
+    gsize slot;
+} ApplyRequest;
+
+static gint
+compare_apply_entries(gconstpointer a,
+                      gconstpointer b)
+{
+    const ApplyEntry *ea = a;
+    const ApplyEntry *eb = b;
+
+    return pq_methods[ea->index].setting - pq_methods[eb->index].setting;
+}
+
+static void
+finish_apply_batch(ApplyBatch *batch)
+{
+    GVariantBuilder changed;
+    GVariantBuilder results;
+    gboolean any_changed = FALSE;
+
+    pq_settings_flush(batch->ctx->settings);
+
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_init(&results, G_VARIANT_TYPE("a{si}"));
+
+    for (gsize i = 0; i < batch->n_entries; i++) {
+        ApplyEntry *entry = &batch->entries[i];
+
+        if (entry->result == 0)
+            any_changed |= cache_property(batch->ctx, entry->index, entry->value, &changed);
+
+        g_variant_builder_add(&results, "{si}", pq_methods[entry->index].property,
+                              entry->result);
+    }
+
+    if (any_changed)
+        emit_properties_changed(batch->ctx, &changed);
+    else
+        g_variant_builder_clear(&changed);
+
+    if (batch->invocation)
+        g_dbus_method_invocation_return_value(batch->invocation,
+                                              g_variant_new("(a{si})", &results));
+    else
+        g_variant_builder_clear(&results);
+    g_free(batch->entries);
+    g_free(batch);
+}
+
+static void
+on_batch_setting_applied(GObject *source,
+                         GAsyncResult *result,
+                         gpointer user_data)
+{
+    ApplyRequest *request = user_data;
+    ApplyBatch *batch = request->batch;
+    GError *error = NULL;
+    int ret = pq_set_setting_finish(result, &error);
+
+    if (error) {
+        g_debug("ApplySettings: %s: %s", pq_methods[batch->entries[request->slot].index].property,
+                error->message);
+        g_error_free(error);
+        ret = -1;
+    }
+
+    batch->entries[request->slot].result = ret;
+    g_free(request);
+
+    if (--batch->outstanding == 0)
+        finish_apply_batch(batch);
+}
+
+static void
+handle_apply_settings(ServiceContext *ctx,
+                      GVariant *parameters,
+                      GDBusMethodInvocation *invocation)
+{
+    GVariantIter *iter;
+    const gchar *key;
+    GVariant *value;
+    GArray *entries = g_array_new(FALSE, FALSE, sizeof(ApplyEntry));
+    guint seen[PQ_SETTING_MAX] = { 0 };
+
+    g_variant_get(parameters, "(a{sv})", &iter);
+    while (g_variant_iter_loop(iter, "{&sv}", &key, &value)) {
+        ApplyEntry entry = { 0 };
+        gsize i;
+
+        for (i = 0; i < G_N_ELEMENTS(pq_methods); i++) {
+            if (g_strcmp0(key, pq_methods[i].property) == 0)
+                break;
+        }
+
+        const gchar *problem = NULL;
+        if (i == G_N_ELEMENTS(pq_methods))
+            problem = "unknown setting";
+        else if (!g_variant_is_of_type(value, G_VARIANT_TYPE_INT32))
+            problem = "expected an int32 value";
+        else if (seen[pq_methods[i].setting]++)
+            problem = "duplicate setting";
+
+        if (problem) {
+            /* Nothing has been sent yet, reject the whole profile */
+            g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                                                  "Invalid entry %s: %s", key, problem);
+            g_variant_unref(value);
+            g_variant_iter_free(iter);
+            g_array_free(entries, TRUE);
+            return;
+        }
+
+        entry.index = i;
+        entry.value = g_variant_get_int32(value);
+        g_array_append_val(entries, entry);
+    }
+    g_variant_iter_free(iter);
+
+    if (entries->len == 0) {
+        g_array_free(entries, TRUE);
+        g_dbus_method_invocation_return_value(invocation, g_variant_new("(a{si})", NULL));
+        return;
+    }
+
+    g_array_sort(entries, compare_apply_entries);
+
+    ApplyBatch *batch = g_new0(ApplyBatch, 1);
+    batch->ctx = ctx;
+    batch->invocation = invocation;
+    batch->n_entries = entries->len;
+    batch->outstanding = entries->len;
+    batch->entries = (ApplyEntry*)g_array_free(entries, FALSE);
+
+    if (return_if_queued(ctx, invocation))
+        batch->invocation = NULL;
+
+    for (gsize i = 0; i < batch->n_entries; i++) {
+        ApplyRequest *request = g_new0(ApplyRequest, 1);
+        request->batch = batch;
+        request->slot = i;
+
+        pq_set_setting_async(ctx->pq_ctx, pq_methods[batch->entries[i].index].setting,
+                             batch->entries[i].value, 5 /* step */,
+                             ctx->settings, NULL, on_batch_setting_applied, request);
+    }
+}
+
 static void
 handle_method_call(GDBusConnection* connection,
                    const gchar* sender,
@@ -126,52 +592,62 @@ handle_method_call(GDBusConnection* connection,
 {
     ServiceContext *ctx = (ServiceContext*)user_data;
     int mode;
-    g_variant_get(parameters, "(i)", &mode);
-
-    if (g_strcmp0(method_name, "SetPQMode") == 0)
-        set_pq_mode_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "EnableBlueLight") == 0)
-        enable_blue_light_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "SetBlueLightStrength") == 0)
-        set_blue_light_strength_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "EnableChameleon") == 0)
-        enable_chameleon_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "SetChameleonStrength") == 0)
-        set_chameleon_strength_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "SetGammaIndex") == 0)
-        set_gamma_index_hidl(ctx->pq_ctx->client, mode, 5 /* step */, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDisplayColor") == 0)
-        set_feature_display_color_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureContentColor") == 0)
-        set_feature_content_color_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureContentColorVideo") == 0)
-        set_feature_content_color_video_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureSharpness") == 0)
-        set_feature_sharpness_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDynamicContrast") == 0)
-        set_feature_dynamic_contrast_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDynamicSharpness") == 0)
-        set_feature_dynamic_sharpness_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDisplayCCorr") == 0)
-        set_feature_display_ccorr_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDisplayGamma") == 0)
-        set_feature_display_gamma_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureDisplayOverDrive") == 0)
-        set_feature_display_over_drive_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureISOAdaptiveSharpness") == 0)
-        set_feature_iso_adaptive_sharpness_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureUltraResolution") == 0)
-        set_feature_ultra_resolution_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-    else if (g_strcmp0(method_name, "SetFeatureVideoHDR") == 0)
-        set_feature_video_hdr_hidl(ctx->pq_ctx->client, mode, ctx->settings);
-
-    g_dbus_method_invocation_return_value(invocation, NULL);
+
+    if (g_strcmp0(method_name, "ApplySettings") == 0) {
+        handle_apply_settings(ctx, parameters, invocation);
+        return;
+    }
+
+    for (gsize i = 0; i < G_N_ELEMENTS(pq_methods); i++) {
+        if (g_strcmp0(method_name, pq_methods[i].method) != 0)
+            continue;
+
+        g_variant_get(parameters, "(i)", &mode);
+
+        SetRequest *request = g_new0(SetRequest, 1);
+        request->ctx = ctx;
+        request->invocation = invocation;
+        request->index = i;
+        request->value = mode;
+
+        if (return_if_queued(ctx, invocation))
+            request->invocation = NULL;
+
+        /* The reply is sent once the HAL answered, without blocking the loop */
+        pq_set_setting_async(ctx->pq_ctx, pq_methods[i].setting, mode, 5 /* step */,
+                             ctx->settings, NULL, on_setting_applied, request);
+        return;
+    }
+
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
+                                          "Unknown method %s", method_name);
+}
+
+static GVariant*
+handle_get_property(GDBusConnection* connection,
+                    const gchar* sender,
+                    const gchar* object_path,
+                    const gchar* interface_name,
+                    const gchar* property_name,
+                    GError** error,
+                    gpointer user_data)
+{
+    ServiceContext *ctx = (ServiceContext*)user_data;
+
+    for (gsize i = 0; i < G_N_ELEMENTS(pq_methods); i++) {
+        if (g_strcmp0(property_name, pq_methods[i].property) == 0)
+            return g_variant_new_int32(ctx->values[pq_methods[i].setting]);
+    }
+
+    g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                "Unknown property %s", property_name);
+    return NULL;
 }
 
 static const
 GDBusInterfaceVTable interface_vtable = {
     handle_method_call,
-    NULL,
+    handle_get_property,
     NULL
 };
 
@@ -184,6 +660,8 @@ on_bus_acquired(GDBusConnection* connection,
     ServiceContext* service_ctx = ((gpointer*)user_data)[1];
     GError* error = NULL;
 
+    service_ctx->connection = connection;
+
     g_dbus_connection_register_object(
         connection,
         "/io/FuriOS/PQ",
@@ -195,6 +673,11 @@ on_bus_acquired(GDBusConnection* connection,
 
     if (error) {
         g_printerr("Error registering object: %s\n", error->message);
+        g_clear_error(&error);
+    }
+
+    if (!pq_stats_export(connection, "/io/FuriOS/PQ", &error)) {
+        g_printerr("Error exporting PQ stats: %s\n", error->message);
         g_error_free(error);
     }
 }
@@ -218,6 +701,13 @@ on_name_lost(GDBusConnection* connection,
         g_main_loop_quit(loop);
 }
 
+static gboolean
+on_quit_signal(gpointer user_data)
+{
+    g_main_loop_quit((GMainLoop*)user_data);
+    return G_SOURCE_CONTINUE;
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -231,6 +721,10 @@ main(int argc, char* argv[])
         return 1;
     }
 
+    refresh_property_cache(service_ctx);
+    pq_set_reconnect_func(service_ctx->pq_ctx, on_pq_reconnected, service_ctx);
+    g_signal_connect(service_ctx->settings, "changed", G_CALLBACK(on_settings_changed), service_ctx);
+
     GDBusNodeInfo* introspection_data = g_dbus_node_info_new_for_xml(introspection_xml, &error);
     if (error) {
         g_printerr("Error parsing introspection XML: %s\n", error->message);
@@ -248,6 +742,9 @@ main(int argc, char* argv[])
     loop = g_main_loop_new(NULL, FALSE);
     user_data[2] = loop;
 
+    g_unix_signal_add(SIGTERM, on_quit_signal, loop);
+    g_unix_signal_add(SIGINT, on_quit_signal, loop);
+
     owner_id = g_bus_own_name(
         G_BUS_TYPE_SESSION,
         "io.FuriOS.PQ",
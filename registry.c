@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * GStreamer registry cache invalidation. The main loop only renames the
+ * cache directory, GStreamer sees it gone right away. The renamed tree
+ * is removed on a worker thread relative to directory fds, so neither
+ * path length nor nesting gets in the way. Only one worker runs at a
+ * time, a cache invalidated meanwhile is picked up by another pass.
+ */
+
+#include "registry.h"
+#include <gio/gio.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REGISTRY_DIR "gstreamer-1.0"
+/* Renamed caches are called gstreamer-1.0.stale-<n> until they're gone */
+#define REGISTRY_STALE_PREFIX REGISTRY_DIR ".stale-"
+
+typedef struct _RegistryDeletion RegistryDeletion;
+
+struct _RegistryCache {
+    gchar *cache_dir;
+    gchar *path;
+    GFileMonitor *monitor;
+    gint64 invalidated_at;
+    /* The pass in flight, and whether another one is due after it */
+    RegistryDeletion *deleting;
+    gboolean rescan;
+};
+
+struct _RegistryDeletion {
+    /* Main loop only, NULL once the cache is freed */
+    RegistryCache *cache;
+    gchar *cache_dir;
+    guint64 entries;
+    guint64 bytes;
+    gint64 elapsed_us;
+};
+
+static void
+registry_deletion_free(gpointer data)
+{
+    RegistryDeletion *deletion = data;
+
+    g_free(deletion->cache_dir);
+    g_free(deletion);
+}
+
+/* Remove everything below dir_fd, closing it */
+static void
+delete_tree_at(int dir_fd,
+               RegistryDeletion *deletion)
+{
+    DIR *dir = fdopendir(dir_fd);
+    struct dirent *entry;
+
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+
+    while ((entry = readdir(dir))) {
+        struct stat st;
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            int child = openat(dirfd(dir), entry->d_name,
+                               O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+            if (child >= 0)
+                delete_tree_at(child, deletion);
+            if (unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR) == 0)
+                deletion->entries++;
+        } else if (unlinkat(dirfd(dir), entry->d_name, 0) == 0) {
+            deletion->entries++;
+            deletion->bytes += st.st_size;
+        }
+    }
+
+    closedir(dir);
+}
+
+/* Also picks up trees an earlier run didn't get to finish */
+static void
+delete_stale_caches(GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+    RegistryDeletion *deletion = task_data;
+    gint64 start = g_get_monotonic_time();
+    int cache_fd;
+    DIR *dir;
+    struct dirent *entry;
+
+    cache_fd = open(deletion->cache_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cache_fd < 0) {
+        g_task_return_boolean(task, TRUE);
+        return;
+    }
+
+    dir = fdopendir(cache_fd);
+    if (!dir) {
+        close(cache_fd);
+        g_task_return_boolean(task, TRUE);
+        return;
+    }
+
+    while ((entry = readdir(dir))) {
+        int tree;
+
+        if (!g_str_has_prefix(entry->d_name, REGISTRY_STALE_PREFIX))
+            continue;
+
+        tree = openat(dirfd(dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (tree < 0)
+            continue;
+
+        delete_tree_at(tree, deletion);
+        unlinkat(dirfd(dir), entry->d_name, AT_REMOVEDIR);
+    }
+    closedir(dir);
+
+    deletion->elapsed_us = g_get_monotonic_time() - start;
+    g_task_return_boolean(task, TRUE);
+}
+
+static void registry_cache_delete_stale(RegistryCache *cache);
+
+static void
+on_stale_caches_deleted(GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+    RegistryDeletion *deletion = g_task_get_task_data(G_TASK(result));
+    RegistryCache *cache = deletion->cache;
+
+    g_print("GStreamer cache cleared: %" G_GUINT64_FORMAT " entries, %" G_GUINT64_FORMAT
+            " KiB in %" G_GINT64_FORMAT " ms\n", deletion->entries, deletion->bytes / 1024,
+            deletion->elapsed_us / 1000);
+
+    if (!cache)
+        return;
+
+    cache->deleting = NULL;
+    if (cache->rescan) {
+        cache->rescan = FALSE;
+        registry_cache_delete_stale(cache);
+    }
+}
+
+/* Two workers on the same trees would trip over each other's unlinkat() */
+static void
+registry_cache_delete_stale(RegistryCache *cache)
+{
+    RegistryDeletion *deletion;
+    GTask *task;
+
+    if (cache->deleting) {
+        cache->rescan = TRUE;
+        return;
+    }
+
+    deletion = g_new0(RegistryDeletion, 1);
+    deletion->cache = cache;
+    deletion->cache_dir = g_strdup(cache->cache_dir);
+    cache->deleting = deletion;
+
+    task = g_task_new(NULL, NULL, on_stale_caches_deleted, NULL);
+    g_task_set_task_data(task, deletion, registry_deletion_free);
+    g_task_run_in_thread(task, delete_stale_caches);
+    g_object_unref(task);
+}
+
+static void
+on_registry_dir_changed(GFileMonitor *monitor,
+                        GFile *file,
+                        GFile *other_file,
+                        GFileMonitorEvent event,
+                        gpointer user_data)
+{
+    RegistryCache *cache = user_data;
+    gchar *name;
+    gboolean registry;
+
+    if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+        event != G_FILE_MONITOR_EVENT_RENAMED &&
+        event != G_FILE_MONITOR_EVENT_MOVED_IN)
+        return;
+
+    /* GStreamer writes registry.<arch>.bin.XXXXXX and renames it into place */
+    name = g_file_get_basename(other_file ? other_file : file);
+    registry = g_str_has_prefix(name, "registry.") && g_str_has_suffix(name, ".bin");
+    g_free(name);
+    if (!registry)
+        return;
+
+    g_print("GStreamer registry rebuilt %" G_GINT64_FORMAT " ms after invalidation\n",
+            (g_get_monotonic_time() - cache->invalidated_at) / 1000);
+
+    g_file_monitor_cancel(cache->monitor);
+    g_clear_object(&cache->monitor);
+}
+
+/* Tell when the next GStreamer user has rebuilt the registry */
+static void
+registry_cache_watch(RegistryCache *cache)
+{
+    GFile *dir = g_file_new_for_path(cache->path);
+    GError *error = NULL;
+
+    if (cache->monitor) {
+        g_file_monitor_cancel(cache->monitor);
+        g_clear_object(&cache->monitor);
+    }
+
+    cache->monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+    if (!cache->monitor) {
+        g_printerr("Failed to watch %s: %s\n", cache->path, error->message);
+        g_error_free(error);
+    } else {
+        g_signal_connect(cache->monitor, "changed", G_CALLBACK(on_registry_dir_changed), cache);
+    }
+
+    g_object_unref(dir);
+}
+
+RegistryCache *
+registry_cache_new(void)
+{
+    RegistryCache *cache = g_new0(RegistryCache, 1);
+
+    cache->cache_dir = g_strdup(g_get_user_cache_dir());
+    cache->path = g_build_filename(cache->cache_dir, REGISTRY_DIR, NULL);
+    return cache;
+}
+
+void
+registry_cache_free(RegistryCache *cache)
+{
+    if (!cache)
+        return;
+
+    /* The worker finishes on its own, its result is only logged */
+    if (cache->deleting)
+        cache->deleting->cache = NULL;
+
+    if (cache->monitor) {
+        g_file_monitor_cancel(cache->monitor);
+        g_object_unref(cache->monitor);
+    }
+
+    g_free(cache->cache_dir);
+    g_free(cache->path);
+    g_free(cache);
+}
+
+void
+registry_cache_invalidate(RegistryCache *cache)
+{
+    gchar *stale;
+
+    stale = g_strdup_printf("%s/" REGISTRY_STALE_PREFIX "%" G_GINT64_FORMAT,
+                            cache->cache_dir, g_get_real_time());
+    if (rename(cache->path, stale) < 0) {
+        if (errno != ENOENT)
+            g_printerr("Failed to move %s away: %s\n", cache->path, g_strerror(errno));
+        g_free(stale);
+        return;
+    }
+    g_free(stale);
+
+    cache->invalidated_at = g_get_monotonic_time();
+    /* GStreamer would create it again anyway, this way it can be watched */
+    if (g_mkdir_with_parents(cache->path, 0700) == 0)
+        registry_cache_watch(cache);
+
+    registry_cache_delete_stale(cache);
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _RegistryCache RegistryCache;
+
+/**
+ * Track the user's GStreamer registry cache, $XDG_CACHE_HOME/gstreamer-1.0.
+ *
+ * @return A new registry cache, free it with registry_cache_free().
+ */
+RegistryCache *registry_cache_new(void);
+
+/**
+ * Free a registry cache. A deletion that is still running finishes on
+ * its own.
+ *
+ * @param cache The registry cache, may be NULL.
+ */
+void registry_cache_free(RegistryCache *cache);
+
+/**
+ * Make GStreamer rebuild its registry, e.g. after a camera HAL restart
+ * changed which plugins work. The cache directory is renamed out of the
+ * way and deleted on a worker thread. How long the deletion took, and
+ * how long until the next GStreamer user rebuilt the registry, is logged.
+ *
+ * @param cache The registry cache.
+ */
+void registry_cache_invalidate(RegistryCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REGISTRY_H
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * Android init service states for gsd-adapter. The property client in
+ * libhybris has no way to be told about a change, so a service's
+ * init.svc.* property is only read again while a transition we asked
+ * for, or somebody's wait, is outstanding. The reads back off, and stop
+ * once nothing is in flight, which leaves nothing on the main loop.
+ */
+
+#include "services.h"
+#include <string.h>
+#include <hybris/properties/properties.h>
+
+/* First re-read after a request, doubled up to the maximum */
+#define SERVICE_POLL_MIN_MS 10
+#define SERVICE_POLL_MAX_MS 250
+/* Stop following a request init never finished */
+#define SERVICE_REQUEST_TIMEOUT_US (10 * G_USEC_PER_SEC)
+
+typedef struct {
+    GTask *task;
+    ServiceState state;
+    guint timeout_id;
+} ServiceWaiter;
+
+typedef struct {
+    gchar *name;
+    gchar *property;
+    ServiceState state;
+    /* Where we asked init to take it, UNKNOWN when nothing is in flight */
+    ServiceState target;
+    gint64 requested_at;
+    GQueue waiters;
+    guint poll_id;
+    guint poll_ms;
+} Service;
+
+struct _ServiceTracker {
+    GHashTable *services;
+};
+
+static ServiceState
+service_parse_state(const char *value)
+{
+    if (strcmp(value, "running") == 0)
+        return SERVICE_STATE_RUNNING;
+    if (strcmp(value, "stopped") == 0)
+        return SERVICE_STATE_STOPPED;
+    if (value[0])
+        return SERVICE_STATE_OTHER;
+    return SERVICE_STATE_UNKNOWN;
+}
+
+/* The waiter must already be off the queue, its callback may call back into us */
+static void
+service_waiter_finish(ServiceWaiter *waiter,
+                      GError *error)
+{
+    if (waiter->timeout_id)
+        g_source_remove(waiter->timeout_id);
+
+    if (error)
+        g_task_return_error(waiter->task, error);
+    else
+        g_task_return_boolean(waiter->task, TRUE);
+
+    g_object_unref(waiter->task);
+    g_free(waiter);
+}
+
+static void
+service_refresh(Service *service)
+{
+    char value[PROP_VALUE_MAX];
+    GList *link, *reached = NULL;
+
+    property_get(service->property, value, "");
+    service->state = service_parse_state(value);
+
+    if (service->target == service->state)
+        service->target = SERVICE_STATE_UNKNOWN;
+
+    link = service->waiters.head;
+    while (link) {
+        GList *next = link->next;
+        ServiceWaiter *waiter = link->data;
+
+        if (waiter->state == service->state) {
+            g_queue_delete_link(&service->waiters, link);
+            reached = g_list_prepend(reached, waiter);
+        }
+        link = next;
+    }
+
+    reached = g_list_reverse(reached);
+    for (link = reached; link; link = link->next)
+        service_waiter_finish(link->data, NULL);
+    g_list_free(reached);
+}
+
+static gboolean service_poll(gpointer user_data);
+
+static void
+service_schedule_poll(Service *service)
+{
+    gboolean needed = service->target != SERVICE_STATE_UNKNOWN || service->waiters.length;
+
+    if (!needed) {
+        if (service->poll_id) {
+            g_source_remove(service->poll_id);
+            service->poll_id = 0;
+        }
+        return;
+    }
+
+    if (service->poll_id)
+        return;
+
+    service->poll_ms = SERVICE_POLL_MIN_MS;
+    service->poll_id = g_timeout_add(service->poll_ms, service_poll, service);
+}
+
+static gboolean
+service_poll(gpointer user_data)
+{
+    Service *service = user_data;
+
+    service->poll_id = 0;
+    service_refresh(service);
+
+    if (service->target != SERVICE_STATE_UNKNOWN &&
+        g_get_monotonic_time() - service->requested_at > SERVICE_REQUEST_TIMEOUT_US) {
+        g_printerr("Init did not take %s to the requested state\n", service->name);
+        service->target = SERVICE_STATE_UNKNOWN;
+    }
+
+    if (service->target == SERVICE_STATE_UNKNOWN && !service->waiters.length)
+        return G_SOURCE_REMOVE;
+
+    service->poll_ms = MIN(service->poll_ms * 2, SERVICE_POLL_MAX_MS);
+    service->poll_id = g_timeout_add(service->poll_ms, service_poll, service);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+service_free(gpointer data)
+{
+    Service *service = data;
+    ServiceWaiter *waiter;
+
+    if (service->poll_id)
+        g_source_remove(service->poll_id);
+
+    while ((waiter = g_queue_pop_head(&service->waiters)))
+        service_waiter_finish(waiter, g_error_new(G_IO_ERROR, G_IO_ERROR_CANCELLED, "Tracker freed"));
+
+    g_free(service->name);
+    g_free(service->property);
+    g_free(service);
+}
+
+static Service *
+service_lookup(ServiceTracker *tracker,
+               const char *name)
+{
+    Service *service = g_hash_table_lookup(tracker->services, name);
+
+    if (service)
+        return service;
+
+    service = g_new0(Service, 1);
+    service->name = g_strdup(name);
+    service->property = g_strconcat("init.svc.", name, NULL);
+    service->target = SERVICE_STATE_UNKNOWN;
+    g_queue_init(&service->waiters);
+    g_hash_table_insert(tracker->services, service->name, service);
+
+    service_refresh(service);
+    return service;
+}
+
+ServiceTracker *
+service_tracker_new(void)
+{
+    ServiceTracker *tracker = g_new0(ServiceTracker, 1);
+
+    tracker->services = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, service_free);
+    return tracker;
+}
+
+void
+service_tracker_free(ServiceTracker *tracker)
+{
+    if (!tracker)
+        return;
+
+    g_hash_table_destroy(tracker->services);
+    g_free(tracker);
+}
+
+ServiceState
+service_tracker_get_state(ServiceTracker *tracker,
+                          const char *name)
+{
+    return service_lookup(tracker, name)->state;
+}
+
+gboolean
+service_tracker_request(ServiceTracker *tracker,
+                        const char *name,
+                        ServiceState state)
+{
+    Service *service = service_lookup(tracker, name);
+
+    g_return_val_if_fail(state == SERVICE_STATE_RUNNING || state == SERVICE_STATE_STOPPED, FALSE);
+
+    /* Nothing is in flight, so the last reading may be old by now */
+    if (service->target == SERVICE_STATE_UNKNOWN && !service->poll_id)
+        service_refresh(service);
+
+    /* No init.svc property, the device doesn't have this service */
+    if (service->state == SERVICE_STATE_UNKNOWN)
+        return FALSE;
+
+    if (service->target == state ||
+        (service->target == SERVICE_STATE_UNKNOWN && service->state == state))
+        return FALSE;
+
+    property_set(state == SERVICE_STATE_RUNNING ? "ctl.start" : "ctl.stop", name);
+    service->target = state;
+    service->requested_at = g_get_monotonic_time();
+    service_schedule_poll(service);
+    return TRUE;
+}
+
+static gboolean
+on_service_wait_timeout(gpointer user_data)
+{
+    ServiceWaiter *waiter = user_data;
+    Service *service = g_task_get_task_data(waiter->task);
+
+    waiter->timeout_id = 0;
+    g_queue_remove(&service->waiters, waiter);
+    service_schedule_poll(service);
+    service_waiter_finish(waiter, g_error_new(G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+                                              "%s did not reach the requested state", service->name));
+    return G_SOURCE_REMOVE;
+}
+
+void
+service_tracker_wait_async(ServiceTracker *tracker,
+                           const char *name,
+                           ServiceState state,
+                           guint timeout_ms,
+                           GAsyncReadyCallback callback,
+                           gpointer user_data)
+{
+    Service *service = service_lookup(tracker, name);
+    GTask *task = g_task_new(NULL, NULL, callback, user_data);
+    ServiceWaiter *waiter;
+
+    g_task_set_task_data(task, service, NULL);
+
+    if (service->state == state) {
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+        return;
+    }
+
+    if (service->state == SERVICE_STATE_UNKNOWN) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "%s is not an init service here", name);
+        g_object_unref(task);
+        return;
+    }
+
+    waiter = g_new0(ServiceWaiter, 1);
+    waiter->task = task;
+    waiter->state = state;
+    waiter->timeout_id = g_timeout_add(timeout_ms, on_service_wait_timeout, waiter);
+    g_queue_push_tail(&service->waiters, waiter);
+
+    service_schedule_poll(service);
+}
+
+gboolean
+service_tracker_wait_finish(GAsyncResult *result,
+                            GError **error)
+{
+    return g_task_propagate_boolean(G_TASK(result), error);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef SERVICES_H
+#define SERVICES_H
+
+#include <gio/gio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SERVICE_STATE_UNKNOWN,
+    SERVICE_STATE_STOPPED,
+    SERVICE_STATE_RUNNING,
+    /* Anything else init reports, e.g. "restarting" or "stopping" */
+    SERVICE_STATE_OTHER,
+} ServiceState;
+
+typedef struct _ServiceTracker ServiceTracker;
+
+/**
+ * Create a tracker for Android init services.
+ *
+ * @return A new tracker, free it with service_tracker_free().
+ */
+ServiceTracker *service_tracker_new(void);
+
+/**
+ * Free a tracker. Pending waits fail with G_IO_ERROR_CANCELLED.
+ *
+ * @param tracker The tracker, may be NULL.
+ */
+void service_tracker_free(ServiceTracker *tracker);
+
+/**
+ * Get the last known state of a service.
+ *
+ * @param tracker The tracker.
+ * @param service The init service name, e.g. "camerahalserver".
+ * @return The state from init.svc.<service>.
+ */
+ServiceState service_tracker_get_state(ServiceTracker *tracker, const char *service);
+
+/**
+ * Ask init to bring a service to a state with ctl.start or ctl.stop,
+ * unless it's already there or on its way.
+ *
+ * @param tracker The tracker.
+ * @param service The init service name.
+ * @param state SERVICE_STATE_RUNNING or SERVICE_STATE_STOPPED.
+ * @return TRUE if init was asked, FALSE if nothing had to be done or the
+ *         device has no such service.
+ */
+gboolean service_tracker_request(ServiceTracker *tracker, const char *service, ServiceState state);
+
+/**
+ * Wait for a service to reach a state.
+ *
+ * @param tracker The tracker.
+ * @param service The init service name.
+ * @param state The state to wait for.
+ * @param timeout_ms Give up after this long with G_IO_ERROR_TIMED_OUT. A
+ *        service the device doesn't have fails with G_IO_ERROR_NOT_FOUND.
+ * @param callback Called once the state was reached or the wait failed.
+ * @param user_data Passed to callback.
+ */
+void service_tracker_wait_async(ServiceTracker *tracker,
+                                const char *service,
+                                ServiceState state,
+                                guint timeout_ms,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data);
+
+/**
+ * Finish a wait started with service_tracker_wait_async().
+ *
+ * @param result The result passed to the callback.
+ * @param error Return location for an error.
+ * @return TRUE if the state was reached.
+ */
+gboolean service_tracker_wait_finish(GAsyncResult *result, GError **error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SERVICES_H
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+/*
+ * System unit control through org.freedesktop.systemd1. A request
+ * returns as soon as systemd has queued the job, and the result is
+ * picked up from JobRemoved, so the main loop never waits on a unit.
+ */
+
+#include "units.h"
+#include <gio/gio.h>
+#include <stdio.h>
+
+#define SYSTEMD_BUS_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_OBJECT_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_MANAGER_INTERFACE "org.freedesktop.systemd1.Manager"
+
+struct _UnitControl {
+    GDBusConnection *connection;
+    GCancellable *cancellable;
+    guint job_removed_id;
+    /* job object path -> "<method> <unit>", for the log */
+    GHashTable *jobs;
+    /* unit -> method, requested before the bus was up */
+    GHashTable *queued;
+};
+
+typedef struct {
+    UnitControl *control;
+    gchar *method;
+    gchar *unit;
+} UnitCall;
+
+static void
+unit_call_free(UnitCall *call)
+{
+    g_free(call->method);
+    g_free(call->unit);
+    g_free(call);
+}
+
+static void
+on_job_removed(GDBusConnection *connection,
+               const gchar *sender_name,
+               const gchar *object_path,
+               const gchar *interface_name,
+               const gchar *signal_name,
+               GVariant *parameters,
+               gpointer user_data)
+{
+    UnitControl *control = user_data;
+    const gchar *job, *unit, *result;
+    const gchar *request;
+    guint32 id;
+
+    g_variant_get(parameters, "(u&o&s&s)", &id, &job, &unit, &result);
+
+    /* Jobs from everyone else on the system end up here too */
+    request = g_hash_table_lookup(control->jobs, job);
+    if (!request)
+        return;
+
+    if (g_strcmp0(result, "done") == 0)
+        g_print("%s finished\n", request);
+    else
+        fprintf(stderr, "%s finished with %s\n", request, result);
+
+    g_hash_table_remove(control->jobs, job);
+}
+
+static void
+on_unit_call_done(GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    UnitCall *call = user_data;
+    GError *error = NULL;
+    GVariant *reply;
+    const gchar *job;
+
+    reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result, &error);
+    if (!reply) {
+        /* The control is gone when cancelled, don't touch it */
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            fprintf(stderr, "Failed to %s %s: %s\n", call->method, call->unit, error->message);
+        g_error_free(error);
+        unit_call_free(call);
+        return;
+    }
+
+    g_variant_get(reply, "(&o)", &job);
+    g_hash_table_insert(call->control->jobs, g_strdup(job),
+                        g_strdup_printf("%s %s", call->method, call->unit));
+    g_variant_unref(reply);
+    unit_call_free(call);
+}
+
+static void
+unit_control_call(UnitControl *control,
+                  const char *method,
+                  const char *unit)
+{
+    UnitCall *call;
+
+    if (!control->connection) {
+        g_hash_table_replace(control->queued, g_strdup(unit), g_strdup(method));
+        return;
+    }
+
+    call = g_new0(UnitCall, 1);
+    call->control = control;
+    call->method = g_strdup(method);
+    call->unit = g_strdup(unit);
+
+    /* "replace" lets a later toggle supersede a job that is still queued */
+    g_dbus_connection_call(control->connection, SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH,
+                           SYSTEMD_MANAGER_INTERFACE, method,
+                           g_variant_new("(ss)", unit, "replace"),
+                           G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                           control->cancellable, on_unit_call_done, call);
+}
+
+static void
+on_system_bus_ready(GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+    UnitControl *control = user_data;
+    GError *error = NULL;
+    GDBusConnection *connection;
+    GHashTableIter iter;
+    gpointer unit, method;
+
+    connection = g_bus_get_finish(result, &error);
+    if (!connection) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            fprintf(stderr, "Failed to connect to the system bus: %s\n", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    control->connection = connection;
+    control->job_removed_id =
+        g_dbus_connection_signal_subscribe(connection, SYSTEMD_BUS_NAME, SYSTEMD_MANAGER_INTERFACE,
+                                           "JobRemoved", SYSTEMD_OBJECT_PATH, NULL,
+                                           G_DBUS_SIGNAL_FLAGS_NONE, on_job_removed, control, NULL);
+
+    /* systemd only emits job signals while someone is subscribed */
+    g_dbus_connection_call(connection, SYSTEMD_BUS_NAME, SYSTEMD_OBJECT_PATH,
+                           SYSTEMD_MANAGER_INTERFACE, "Subscribe", NULL, NULL,
+                           G_DBUS_CALL_FLAGS_NONE, -1, control->cancellable, NULL, NULL);
+
+    g_hash_table_iter_init(&iter, control->queued);
+    while (g_hash_table_iter_next(&iter, &unit, &method))
+        unit_control_call(control, method, unit);
+    g_hash_table_remove_all(control->queued);
+}
+
+UnitControl *
+unit_control_new(void)
+{
+    UnitControl *control = g_new0(UnitControl, 1);
+
+    control->cancellable = g_cancellable_new();
+    control->jobs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    control->queued = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    g_bus_get(G_BUS_TYPE_SYSTEM, control->cancellable, on_system_bus_ready, control);
+
+    return control;
+}
+
+void
+unit_control_free(UnitControl *control)
+{
+    if (!control)
+        return;
+
+    g_cancellable_cancel(control->cancellable);
+    g_object_unref(control->cancellable);
+
+    if (control->connection) {
+        if (control->job_removed_id)
+            g_dbus_connection_signal_unsubscribe(control->connection, control->job_removed_id);
+        g_object_unref(control->connection);
+    }
+
+    g_hash_table_destroy(control->jobs);
+    g_hash_table_destroy(control->queued);
+    g_free(control);
+}
+
+void
+unit_control_start(UnitControl *control,
+                   const char *unit)
+{
+    unit_control_call(control, "StartUnit", unit);
+}
+
+void
+unit_control_stop(UnitControl *control,
+                  const char *unit)
+{
+    unit_control_call(control, "StopUnit", unit);
+}
+
+void
+unit_control_restart(UnitControl *control,
+                     const char *unit)
+{
+    unit_control_call(control, "RestartUnit", unit);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 Bardia Moshiri
+ * SPDX-License-Identifier: GPL-3.0+
+ * Author: Bardia Moshiri <fakeshell@bardia.tech>
+ */
+
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _UnitControl UnitControl;
+
+/**
+ * Connect to the system manager asynchronously. Requests made before
+ * the connection is up are sent once it is, only the last one per unit.
+ *
+ * @return A new unit control, free it with unit_control_free().
+ */
+UnitControl *unit_control_new(void);
+
+/**
+ * Cancel outstanding calls and free a unit control. Jobs that were
+ * already queued in systemd keep running.
+ *
+ * @param control The unit control, may be NULL.
+ */
+void unit_control_free(UnitControl *control);
+
+/**
+ * Queue a start job for a system unit without waiting for it.
+ *
+ * @param control The unit control.
+ * @param unit The full unit name, e.g. "geoclue.service".
+ */
+void unit_control_start(UnitControl *control, const char *unit);
+
+/**
+ * Queue a stop job for a system unit without waiting for it.
+ *
+ * @param control The unit control.
+ * @param unit The full unit name, e.g. "geoclue.service".
+ */
+void unit_control_stop(UnitControl *control, const char *unit);
+
+/**
+ * Queue a restart job for a system unit without waiting for it.
+ *
+ * @param control The unit control.
+ * @param unit The full unit name, e.g. "geoclue.service".
+ */
+void unit_control_restart(UnitControl *control, const char *unit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UNITS_H